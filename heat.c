@@ -7,13 +7,23 @@
 #define _GNU_SOURCE
 
 #include <ctype.h>
+#include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
-//#include <sys/ioctl.h>
+#include <sys/inotify.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <termios.h>
 #include <time.h>
@@ -22,6 +32,25 @@
 #define HEAT_VERSION "1.0.0"
 #define HEAT_TAB_STOP 8
 #define HEAT_QUIT_TIMES 3
+#define HEAT_RESIZE_SETTLE_MS 20        //how long the terminal has to stay the same size before we redraw
+#define HEAT_RESIZE_MAX_WAIT 5          //but never wait more than this many settle periods
+#define HEAT_PARALLEL_MIN_ROWS 20000    //files smaller than this are highlighted on one thread
+#define HEAT_MAX_THREADS 64
+#define HEAT_CACHE_MB 32                //default memory budget for rendered rows, HEAT_CACHE_MB overrides it
+#define HEAT_COLD_MIN_ROWS 20000        //buffers smaller than this are never packed
+#define HEAT_COLD_ROWS 256              //rows looked at (and packed together) at a time
+#define HEAT_COLD_DISTANCE 1000         //rows closer than this to the cursor or the screen stay unpacked
+#define HEAT_COLD_TICK_MS 10            //how long packing may run each time the editor is idle
+#define HEAT_COALESCE_MS 50             //keys that are already waiting get handled for this long before a redraw
+#define HEAT_OSC52_MAX 100000           //copies bigger than this don't go to the terminal clipboard
+#define HEAT_DIFF_MAX_EDITS 2000        //a reload that changes more lines than this is diffed between lines that are unique
+#define HEAT_MEMO_SIZE 4096             //highlighted lines remembered by their hash, a power of two
+#define HEAT_MEMO_LINE 512              //longer lines aren't worth remembering
+#define HEAT_SYNTAX_ARGS 64             //words on one line of a .syntax file, repeat the directive for more
+
+#ifndef HEAT_SYNTAX_DIR
+#define HEAT_SYNTAX_DIR "/usr/local/share/heat/syntax"   //where make install puts syntax/*.syntax
+#endif
 
 //this CTRL_KEY & bitwises the character with 00011111
 //basically making the first three 0 so we know the CTRL is pressed
@@ -54,48 +83,177 @@ enum editorHighlight {
     HL_KEYWORD1,
     HL_KEYWORD2
 };
+#define HL_SELECTED 0x80                // or'd into a copy of hl while drawing, for the block and extra cursors
+#define HL_MATCH 0x40                   // same, for the bracket matching the one under the cursor
 
 /*---------------------------------------------------FILE DETECTION---------------------------------------------*/
 #define HL_HIGHLIGHT_NUMBERS (1 << 0)   // this is a flag bit
 #define HL_HIGHLIGHT_STRINGS (1 << 1)
 
+// the state the lexer is in at the end of a row, carried over into the next one
+#define HL_STATE_NORMAL 0
+#define HL_STATE_COMMENT 1              // inside a block comment
+
+// what the keyword/comment DFA found when it stopped in an accepting state
+enum editorToken {
+    TOK_NONE = 0,
+    TOK_KEYWORD1,
+    TOK_KEYWORD2,
+    TOK_COMMENT,                        // rest of the line is a comment
+    TOK_BLOCK_COMMENT                   // a block comment starts here
+};
+
+// a language, read from a .syntax file and compiled into a table driven lexer: every byte maps to a
+// character class, and keywords and comment starts are all merged into one DFA over those classes
 struct editorSyntax {
     char* filetype;                     // this will display to the user what type of file it is
-    char** filematch;                   // this will match the file to an array of strings to see what type of file it is
-    char** keywords;                    // list of all the keywords to highlight
-    char* singleline_comment_start;     // since most languages have different ways to have comments
+    char** filematch;                   // extensions (starting with '.') or patterns to look for in the file name
+    int numFilematch;
+    char* block_comment_end;            // since most languages have different ways to have comments
     int flags;                          // bit field that has flags to highlight or not
+    char escape;                        // escapes the next character in a string
+
+    unsigned char charclass[256];       // which column of the transition table a byte uses, 0 for all the others
+    int numClasses;
+    int numStates;                      // state 1 is the start, 0 means there's no transition
+    int* transitions;                   // numStates rows of numClasses entries
+    unsigned char* accept;              // the token for every state, TOK_NONE if it isn't accepting
+    unsigned char separator[256];       // keywords and numbers have to start and end next to one of these
+    unsigned char stringDelim[256];
+    unsigned char numberStart[256], numberBody[256];
 };
 
-char* C_HL_EXTENSIONS[] = {".c", ".h", ".cpp", ".py", ".html", ".css", ".js", NULL};
-char* C_HL_KEYWORDS[] = {"if", "for", "while", "switch", "break", "continue", "return", "else", "struct", "enum", "class", "case",
-        "union", "typedef", "static", "default", "#define", "#include", "int|", "long|", "double|", "float|", "char|", "void|", "unsigned|", "signed|", NULL};
-
-// HLDB is highlight database, this is declaring a struct called HLDB that has the c filetype
-struct editorSyntax HLDB[] = {
-    {
-        "c",
-        C_HL_EXTENSIONS,
-        C_HL_KEYWORDS,
-        "//",
-        HL_HIGHLIGHT_NUMBERS | HL_HIGHLIGHT_STRINGS
-    },
+// used when no syntax files are found, so C files still get highlighted out of the box
+// the other languages live in syntax/*.syntax and are loaded at startup (see editorLoadSyntaxes)
+char* HEAT_BUILTIN_SYNTAX =
+    "filetype c\n"
+    "extensions .c .h .cpp .hpp .cc\n"
+    "keywords if for while do switch break continue return else struct enum class case goto\n"
+    "keywords union typedef static const extern default sizeof #define #include #if #ifdef #ifndef #endif\n"
+    "types int long short double float char void unsigned signed size_t\n"
+    "comment //\n"
+    "block_comment /* */\n"
+    "strings \" '\n"
+    "escape \\\n"
+    "numbers decimal hex float\n";
+
+// HLDB is highlight database, every language that was loaded
+struct editorSyntax* HLDB = NULL;
+int hldbEntries = 0;
+
+// maps a file extension to its entry in HLDB, open addressing with linear probing
+struct extensionSlot {
+    char* ext;
+    int syntax;
 };
-
-#define HLDB_ENTRIES (sizeof(HLDB) / sizeof(HLDB[0]))
-
+struct extensionSlot* extensionMap = NULL;
+int extensionMapSize = 0;                // always a power of two
 
 /*---------------------------------------------------STORING ROWS---------------------------------------------*/
 
 //this will store a row of text in the editor
 //this typedef lets us identify erow as a struct erow, basically an abbreviation
+//chars is a rowbuf (see ROW STORAGE), so it can be shared between buffers
+//what actually gets drawn (render and hl) is only built for rows on screen, see RENDER CACHE
+//the fields are ordered so there's no padding between them, big files have millions of these
 typedef struct erow {
     int size;
+    int rwidth;             // how many screen columns render takes up, not the same as the byte count with UTF-8
     char* chars;
+    struct coldBlock* cold; // set instead of chars while the row is packed away, see COLD STORAGE
+    int coldOffset;         // where the row's text starts in its block once unpacked
+    int vlines;             // how many screen lines the row takes up when soft wrapped
+    int cache;              // slot of the row's entry in the render cache, -1 if it has none
+    unsigned int cacheGen;  // generation of that slot when the entry was made, see RENDER CACHE
+    int closes, opens;      // brackets the row closes from the rows above and leaves open, see BRACKETS
+    uint32_t hash;          // of its text and the state it started in when it was last highlighted, see ROW MEMO
+    unsigned char hlstate;  // the lexer state at the end of the row, the next row starts in it
+}erow;
+
+// the drawable version of a row: tabs expanded, control characters replaced, and a color for every byte
+struct rowRender {
     char* render;           //contains the actual characters that are drawn to text
-    int rsize;
     unsigned char* hl;      // contains the highlighting of the characters in the row
-}erow;
+    int rsize;
+    int capacity;           // room in both render and hl, which share one allocation
+};
+
+// a pool of rowRenders for the rows that were drawn recently, kept under a memory budget
+struct renderEntry {
+    struct rowRender r;
+    unsigned int gen;       // bumped every time the slot is emptied, so stale references can tell
+    int used;
+    int prev, next;         // neighbours in the LRU list, or the next free slot
+};
+
+struct renderCache {
+    struct renderEntry* entries;
+    int capacity;
+    int head, tail;         // most and least recently used slot, -1 when empty
+    int freeSlot;           // first free slot, the free ones are chained through next
+    size_t bytes, limit;
+};
+struct renderCache RC = {NULL, 0, -1, -1, -1, 0, 0};
+
+// the chars of rows far from the screen, packed together
+struct coldBlock {
+    int refs;               // one for every row that still points into it
+    unsigned long id;       // unlike the address this is never reused
+    int rawSize, packedSize;
+    char data[];
+};
+
+// one unpacked block, reading the rows of a block one after another only unpacks it once
+struct coldView {
+    unsigned long id;       // 0 when empty
+    char* text;
+    int capacity;
+};
+
+struct coldStore {
+    unsigned long nextId;
+    size_t rawBytes, packedBytes;   // over every block that's still alive
+    double unpackUs;                // running average of how long unpacking a block takes
+    int scan;                       // where packing left off, it goes round the active buffer
+    struct coldView view;           // the main thread's view, the highlighting threads have their own
+};
+struct coldStore CS = {1, 0, 0, 0, 0, {0, NULL, 0}};
+
+// a node of the bracket tree: what a range of rows closes from above it and leaves open below it
+struct bracketCount {
+    int closes, opens;
+};
+
+//an extra cursor, as a chars index like cursorX
+struct cursor {
+    int x, y;
+};
+
+// everything that belongs to one open file; the active buffer lives directly in E,
+// the others are parked here until they are switched to, so their rows and wrap tree stay warm
+struct editorBuffer {
+    erow* row;
+    int numRows;
+    int cursorX, cursorY;
+    int rx;
+    int rowoff, coloff;
+    int dirty;
+    char* filename;
+    struct editorSyntax* syntax;
+    int voff;
+    int* wraptree;
+    int wrapRows, wrapWidth, wrapStale;
+    int wrapSize;
+    struct cursor* cursors;
+    int numCursors;
+    int block, blockX, blockY;
+    int mark, markY;
+    struct bracketCount* brackettree;
+    int bracketRows, bracketStale;
+    int bracketSize;
+    int watch, diskChanged;
+    struct hexView* hex;
+};
 
 //this just puts our terminal into a global struct so we can add in the width and height
 struct editorConfig {
@@ -112,19 +270,107 @@ struct editorConfig {
     char* filename;                 //to display filename in the status bar
     char statusmsg[80];             //to display the messages to the user
     time_t statusmsg_time;          //timestamp to see how long to display messages
+    int screenrows;                 //rows available for text, shared by the panes when split
+    struct editorBuffer* buffers;   //every open buffer, the slot at curBuffer is stale while it is active
+    int numBuffers;
+    int curBuffer;
+    int split;                      //whether the screen is split into two panes
+    int splitTop, splitBottom;      //which buffer is shown in each pane when split
+    int wrap;                       //soft wrap long lines instead of scrolling sideways
+    int voff;                       //visual line at the top of the screen when wrapping
+    int* wraptree;                  //segment tree over the vlines of every row
+    int wrapRows, wrapWidth;        //what the tree was built for, it is rebuilt if either changes
+    int wrapStale;                  //set when the rows were replaced wholesale, or the tree ran out of leaves
+    int wrapSize;                   //leaves in the tree, like bracketSize
+    int gutter;                     //show line numbers to the left of the text
+    struct cursor* cursors;         //extra cursors besides cursorX/cursorY, sorted by row then column
+    int numCursors;
+    int block;                      //whether a rectangular block is being selected
+    int blockX, blockY;             //the corner it started from, the cursor is the other one
+    int mark, markY;                //whether lines are being selected, and the line it started on
+    struct bracketCount* brackettree; //segment tree over the closes and opens of every row
+    int bracketRows, bracketStale;  //like wrapRows and wrapStale
+    int bracketSize;                //leaves in the tree, rows can be added until they run out
+    int inotifyFd;                  //one inotify instance watches every open file, -1 if there isn't one
+    int watch;                      //its watch on this buffer's file, 0 if there is none
+    int diskChanged;                //1 once the file changed on disk, 2 after saving over it was warned about
+    struct hexView* hex;            //set when the file is shown as hex instead of rows (see HEX VIEW)
 };
 struct editorConfig E;
 
+// what the terminal is showing right now, so a redraw only sends the lines that changed (see OUTPUT)
+struct paneState {
+    int buffer, wrap;
+    int start, rows;                //where the pane is on the screen
+    int top;                        //rowoff, or voff when wrapping
+};
+
+struct screenState {
+    uint64_t* lines;                //hash of what's on every screen line, 0 if it isn't known
+    int numLines;
+    struct paneState pane[2];       //the only pane, or the top and bottom ones when split
+    unsigned long epoch;            //bumped whenever all of it is thrown away
+};
+struct screenState S = {NULL, 0, {{-1, 0, 0, 0, 0}, {-1, 0, 0, 0, 0}}, 0};
+
+// what Ctrl-C and Ctrl-X put away (see YANK REGISTER)
+struct yankRegister {
+    erow* source;                   //row array of the buffer it was copied from, while it's only a reference
+    erow* rows;                     //its own rows, once it has them
+    int start, numRows;             //which rows of source, or how many rows
+    struct editorSyntax* syntax;    //what the rows were highlighted as, their states only mean something for that
+};
+struct yankRegister Y = {NULL, NULL, 0, 0, NULL};
+
+// the bracket matching the one under the cursor, found once per frame (see BRACKETS)
+struct bracketMatch {
+    erow* rows;                     //row array of the buffer it's in, NULL if there is none
+    int y, at;                      //its row and render byte
+};
+struct bracketMatch M = {NULL, 0, 0};
+
+//set by the SIGWINCH handler, the only thing a signal handler can safely touch
+volatile sig_atomic_t resizePending = 0;
+
 
 /*---------------------------------------------------PROTOTYPES-----------------------------------------------------*/
 
 void editorSetStatusMessage(const char* fmt, ...);
 void editorRefreshScreen();
 char* editorPrompt(char* prompt);
+void editorUpdateRow(erow* row);
+void editorRenderRow(erow* row, struct coldView* view, struct rowRender* r);
+void editorFreeRender(struct rowRender* r);
+struct rowRender* editorRowRender(erow* row);
+void editorCacheDrop(erow* row);
+void editorHighlightRows();
+void editorHandleResize();
+void editorColdTick();
+void editorMoveCursor(int key);
+void editorYankDetach(int at);
+void editorBracketUpdate(erow* row, struct rowRender* r);
+void editorBracketFix(erow* row);
+void editorBracketReplace(int at, int n, int m);
+int editorBracketSize(int rows);
+int editorRowRefresh(erow* row, int in, struct rowRender* scratch);
+void editorCheckDisk(int ignore);
+void editorWatchFile();
+void editorUnwatchFile();
+int editorRowBrackets(erow* row, struct rowRender* r);
+int editorRenderColumn(erow* row, struct rowRender* r, int col);
+int editorPaneRows(int bottom);
+int editorIsBinary(const char* filename);
+int editorHexOpen();
+void editorHexFree();
+void editorHexSave();
+void editorHexReload();
+void editorHexScroll();
+void editorOutputFlush();
 
 /*--------------------------------------------------TERMINAL--------------------------------------------------------*/
 //this will Print Error of whatever the string that is inserted
 void die(const char *s) {
+    editorOutputFlush();            //the writer thread may be halfway through a frame
     write(STDOUT_FILENO, "\x1b[2J", 4);
     write(STDOUT_FILENO, "\x1b[H", 3);
     perror(s);
@@ -173,10 +419,14 @@ void enableRawMode() {
 //asks for the input from the keyboard
 int editorReadKey() {
     int nread;
-    char c;
+    unsigned char c;        //unsigned so UTF-8 bytes come back as 128-255 instead of negative numbers
     //while the nread is not 1 means that there is no character input from the keyboard yet
+    //a resize interrupts the read with EINTR, so it gets handled while we wait for keys
     while((nread = read(STDIN_FILENO, &c, 1)) != 1) {
-        if(nread == -1 && errno != EAGAIN) die("read");
+        if(nread == -1 && errno != EAGAIN && errno != EINTR) die("read");
+        if(resizePending) editorHandleResize();
+        if(nread == 0) editorColdTick();        //nothing typed for a while, a good time to pack rows
+        if(nread == 0) editorCheckDisk(0);
     }
 
     //if the key read is an escape character, we look at the next two bytes provided
@@ -262,72 +512,857 @@ int getWindowSize(int* rows, int* cols) {
     }
 }
 
+/*-------------------------------------------------ROW STORAGE-------------------------------------------------*/
+
+// every chars array is a rowbuf: the bytes are preceded by a small header with a
+// reference count, so opening the same file twice only bumps counts instead of copying every line
+// rbRealloc is the only way to get a writable block, and it copies the block if anybody else
+// still holds it, so the sharing is copy-on-write at the level of a single row
+struct rowbuf {
+    int refs;
+    size_t size;
+    char data[];
+};
+
+#define RB_HEADER(p) ((struct rowbuf*)((char*)(p) - offsetof(struct rowbuf, data)))
+
+void* rbAlloc(size_t size) {
+    struct rowbuf* rb = malloc(sizeof(struct rowbuf) + size);
+    if(rb == NULL) die("malloc");
+    rb->refs = 1;
+    rb->size = size;
+    return rb->data;
+}
+
+void* rbRetain(void* p) {
+    if(p) RB_HEADER(p)->refs++;
+    return p;
+}
+
+void rbRelease(void* p) {
+    if(p == NULL) return;
+    struct rowbuf* rb = RB_HEADER(p);
+    if(--rb->refs == 0) free(rb);
+}
+
+// like realloc, but the block returned is always private to the caller
+void* rbRealloc(void* p, size_t size) {
+    if(p == NULL) return rbAlloc(size);
+
+    struct rowbuf* rb = RB_HEADER(p);
+    if(rb->refs == 1) {
+        rb = realloc(rb, sizeof(struct rowbuf) + size);
+        if(rb == NULL) die("realloc");
+        rb->size = size;
+        return rb->data;
+    }
+
+    char* copy = rbAlloc(size);
+    memcpy(copy, p, rb->size < size ? rb->size : size);
+    rb->refs--;
+    return copy;
+}
+
+/*-------------------------------------------------COLD STORAGE------------------------------------------------*/
+
+// big files mostly sit there unread, so blocks of rows far away from the cursor and the screen get their
+// chars packed together with a small LZ4 style compressor (lzCompress below writes the LZ4 block format)
+// packing happens while the editor waits for keys, and while a big file is read in, so it never holds up typing
+// reading a cold row unpacks its whole block into a coldView and points into that, so drawing, saving and
+// cursor movement never copy anything back out; only editing a row thaws it, giving it its own chars again
+
+#define LZ_HASH_BITS 12
+#define LZ_MIN_MATCH 4
+
+// the most lzCompress can write for n bytes
+int lzBound(int n) {
+    return n + n / 255 + 16;
+}
+
+// writes a length that doesn't fit in its 4 bits of the token as a run of extra bytes
+int lzPutLength(unsigned char* out, int o, int len) {
+    while(len >= 255) {
+        out[o++] = 255;
+        len -= 255;
+    }
+    out[o++] = len;
+    return o;
+}
+
+// one sequence: literals followed by a match, or only literals for the last one (offset 0)
+int lzEmit(unsigned char* out, int o, const unsigned char* lit, int litLen, int offset, int matchLen) {
+    int token = o++;
+    out[token] = (litLen < 15 ? litLen : 15) << 4;
+    if(litLen >= 15) o = lzPutLength(out, o, litLen - 15);
+    memcpy(&out[o], lit, litLen);
+    o += litLen;
+    if(offset == 0) return o;
+
+    out[o++] = offset & 0xff;
+    out[o++] = offset >> 8;
+    matchLen -= LZ_MIN_MATCH;
+    out[token] |= matchLen < 15 ? matchLen : 15;
+    if(matchLen >= 15) o = lzPutLength(out, o, matchLen - 15);
+    return o;
+}
+
+// greedy matching with one candidate per hash, like LZ4's fast mode; dst needs lzBound(n) bytes
+int lzCompress(const char* src, int n, char* dst) {
+    const unsigned char* in = (const unsigned char*)src;
+    unsigned char* out = (unsigned char*)dst;
+    int table[1 << LZ_HASH_BITS];
+    memset(table, -1, sizeof(table));
+
+    //the format wants the last match to end at least 5 bytes before the end
+    int limit = n - 12;
+    int anchor = 0, i = 0, o = 0;
+    while(i < limit) {
+        unsigned int seq;
+        memcpy(&seq, &in[i], 4);
+        int h = (seq * 2654435761u) >> (32 - LZ_HASH_BITS);
+        int ref = table[h];
+        table[h] = i;
+        if(ref < 0 || i - ref > 65535 || memcmp(&in[ref], &in[i], 4) != 0) {
+            i += 1 + ((i - anchor) >> 6);           //skips ahead faster through stuff that doesn't compress
+            continue;
+        }
+
+        int len = LZ_MIN_MATCH;
+        while(i + len < n - 5 && in[ref + len] == in[i + len]) len++;
+        o = lzEmit(out, o, &in[anchor], i - anchor, i - ref, len);
+        i += len;
+        anchor = i;
+    }
+    return lzEmit(out, o, &in[anchor], n - anchor, 0, 0);
+}
+
+// returns -1 if the data doesn't unpack to exactly "raw" bytes
+int lzDecompress(const char* src, int packed, char* dst, int raw) {
+    const unsigned char* in = (const unsigned char*)src;
+    const unsigned char* end = in + packed;
+    char* op = dst;
+    char* oend = dst + raw;
+
+    while(in < end) {
+        int token = *in++;
+        int len = token >> 4;
+        if(len == 15) {
+            int b;
+            do {
+                if(in >= end) return -1;
+                b = *in++;
+                len += b;
+            }while(b == 255);
+        }
+        if(len > end - in || len > oend - op) return -1;
+        memcpy(op, in, len);
+        in += len;
+        op += len;
+        if(in >= end) break;
+
+        if(end - in < 2) return -1;
+        int offset = in[0] | (in[1] << 8);
+        in += 2;
+        len = token & 15;
+        if(len == 15) {
+            int b;
+            do {
+                if(in >= end) return -1;
+                b = *in++;
+                len += b;
+            }while(b == 255);
+        }
+        len += LZ_MIN_MATCH;
+        if(offset == 0 || offset > op - dst || len > oend - op) return -1;
+
+        //matches can overlap what they're writing, so anything close has to go byte by byte
+        char* match = op - offset;
+        if(offset >= len) {
+            memcpy(op, match, len);
+            op += len;
+        }else {
+            while(len--) *op++ = *match++;
+        }
+    }
+    return op == oend ? 0 : -1;
+}
+
+double editorNowUs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+void coldRelease(struct coldBlock* b) {
+    if(--b->refs > 0) return;
+    CS.rawBytes -= b->rawSize;
+    CS.packedBytes -= b->packedSize;
+    free(b);
+}
+
+// the text of a row, unpacking its block into view first if the row is cold
+// safe on any thread as long as every thread has its own view; the pointer is good until view is reused
+char* editorRowText(erow* row, struct coldView* view) {
+    if(row->chars) return row->chars;
+
+    struct coldBlock* b = row->cold;
+    if(view->id != b->id) {
+        if(b->rawSize > view->capacity) {
+            view->text = realloc(view->text, b->rawSize);
+            if(view->text == NULL) die("realloc");
+            view->capacity = b->rawSize;
+        }
+        double start = view == &CS.view ? editorNowUs() : 0;
+        if(lzDecompress(b->data, b->packedSize, view->text, b->rawSize) == -1) die("unpack");
+        if(view == &CS.view) CS.unpackUs = CS.unpackUs * 0.9 + (editorNowUs() - start) * 0.1;
+        view->id = b->id;
+    }
+    return view->text + row->coldOffset;
+}
+
+void editorFreeView(struct coldView* view) {
+    free(view->text);
+    view->text = NULL;
+    view->id = 0;
+    view->capacity = 0;
+}
+
+// gives a cold row its own chars again, before anything writes to them
+void editorRowThaw(erow* row) {
+    if(row >= E.row && row < &E.row[E.numRows]) editorYankDetach(row - E.row);
+    if(row->chars) return;
+    char* text = editorRowText(row, &CS.view);
+    row->chars = rbAlloc(row->size + 1);
+    memcpy(row->chars, text, row->size + 1);
+    coldRelease(row->cold);
+    row->cold = NULL;
+}
+
+// packs every row in [start, end) of the active buffer that isn't cold yet into one block
+// nothing happens if they wouldn't get at least a bit smaller
+void editorColdFreeze(int start, int end) {
+    int raw = 0;
+    for(int i = start; i < end; i++) {
+        if(E.row[i].chars) raw += E.row[i].size + 1;      //every row keeps its nul
+    }
+    if(raw == 0) return;
+
+    char* text = malloc(raw);
+    struct coldBlock* b = malloc(sizeof(struct coldBlock) + lzBound(raw));
+    if(text == NULL || b == NULL) die("malloc");
+    int at = 0;
+    for(int i = start; i < end; i++) {
+        if(E.row[i].chars == NULL) continue;
+        memcpy(&text[at], E.row[i].chars, E.row[i].size + 1);
+        at += E.row[i].size + 1;
+    }
+    int packed = lzCompress(text, raw, b->data);
+    free(text);
+    if(packed > raw - raw / 8) {
+        free(b);
+        return;
+    }
+
+    b = realloc(b, sizeof(struct coldBlock) + packed);
+    b->refs = 0;
+    b->id = CS.nextId++;
+    b->rawSize = raw;
+    b->packedSize = packed;
+    CS.rawBytes += raw;
+    CS.packedBytes += packed;
+
+    at = 0;
+    for(int i = start; i < end; i++) {
+        erow* row = &E.row[i];
+        if(row->chars == NULL) continue;
+        rbRelease(row->chars);
+        row->chars = NULL;
+        row->cold = b;
+        row->coldOffset = at;
+        b->refs++;
+        at += row->size + 1;
+    }
+}
+
+// called while waiting for keys, packs whatever has gone cold until its time is up or it has been all the way round
+void editorColdTick() {
+    if(E.numRows < HEAT_COLD_MIN_ROWS) return;
+
+    double deadline = editorNowUs() + HEAT_COLD_TICK_MS * 1000;
+    int near = E.cursorY;
+    int seen = 0;
+    while(seen < E.numRows && editorNowUs() < deadline) {
+        if(CS.scan >= E.numRows) CS.scan = 0;
+        int start = CS.scan;
+        int end = start + HEAT_COLD_ROWS < E.numRows ? start + HEAT_COLD_ROWS : E.numRows;
+        CS.scan = end;
+        seen += end - start;
+
+        //the cursor is always on screen, so staying away from it keeps the screen and recent edits warm
+        if(end > near - HEAT_COLD_DISTANCE && start < near + HEAT_COLD_DISTANCE) continue;
+        if(end > E.rowoff - HEAT_COLD_DISTANCE && start < E.rowoff + E.rows + HEAT_COLD_DISTANCE) continue;
+        editorColdFreeze(start, end);
+    }
+}
+
+/*--------------------------------------------------RESIZING--------------------------------------------------*/
+
+void handleSigWinch(int sig) {
+    (void)sig;
+    resizePending = 1;
+}
+
+// installed without SA_RESTART so a resize wakes editorReadKey up right away
+void editorWatchResize() {
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handleSigWinch;
+    sigemptyset(&sa.sa_mask);
+    if(sigaction(SIGWINCH, &sa, NULL) == -1) die("sigaction");
+}
+
+// every thread is started with SIGWINCH blocked, so it is always the main thread that gets it and wakes up
+// out of editorReadKey; the caller puts "old" back with pthread_sigmask once its threads are started
+void editorBlockResize(sigset_t* old) {
+    sigset_t winch;
+    sigemptyset(&winch);
+    sigaddset(&winch, SIGWINCH);
+    pthread_sigmask(SIG_BLOCK, &winch, old);
+}
+
+// sets the screen size, nothing that depends on it is recomputed here: render and hl don't
+// depend on the width at all, and the wrap tree notices its width is out of date and rebuilds on next use
+// only the record of what's on the screen is thrown away, so the next redraw sends everything
+void editorSetScreenSize(int rows, int cols) {
+    E.screenrows = rows - 2;            //leaving room for the status and message bars
+    if(E.screenrows < 1) E.screenrows = 1;
+    E.cols = cols > 0 ? cols : 1;
+    E.rows = E.split ? editorPaneRows(E.curBuffer == E.splitBottom) : E.screenrows;
+    if(E.rows < 1) E.rows = 1;
+
+    //whatever the terminal shows after a resize, it isn't what was drawn before
+    S.numLines = E.screenrows + 2;
+    S.lines = realloc(S.lines, sizeof(uint64_t) * S.numLines);
+    if(S.lines == NULL) die("realloc");
+    memset(S.lines, 0, sizeof(uint64_t) * S.numLines);
+    S.pane[0].buffer = S.pane[1].buffer = -1;
+    S.epoch++;
+}
+
+// dragging a window sends a storm of SIGWINCHs, so we wait for the size to settle and then
+// do one redraw for all of them; the wait is bounded so a long drag still shows progress
+void editorHandleResize() {
+    int waited = 0;
+    do {
+        resizePending = 0;
+        struct timespec settle = {0, HEAT_RESIZE_SETTLE_MS * 1000000L};
+        nanosleep(&settle, NULL);
+    } while(resizePending && ++waited < HEAT_RESIZE_MAX_WAIT);
+
+    int rows, cols;
+    if(getWindowSize(&rows, &cols) == -1) return;
+    editorSetScreenSize(rows, cols);
+    editorRefreshScreen();
+}
+
+/*--------------------------------------------------UNICODE--------------------------------------------------*/
+
+// text is kept as UTF-8 bytes everywhere, cursorX is a byte index into chars and rx is a screen column
+// a grapheme cluster is one character on screen: a base character plus any zero width marks after it,
+// and anything glued on with a zero width joiner; the cursor always moves by whole clusters
+// ASCII bytes are always one column and always start a new cluster, so runs of ASCII skip decoding as long
+// as the next byte is ASCII too; a combining mark after an ASCII letter still belongs to the letter
+
+struct widthRange {
+    unsigned int first, last;
+};
+
+// these tables were generated from the Unicode 14.0 character database (general category Mn/Me/Cf for
+// zero width, East Asian Width W/F for double width), with unassigned gaps merged into the ranges
+// lookups are a binary search, so there's no call to wcwidth() or the locale at all
+static const struct widthRange zeroWidthTable[] = {
+    {0x00300, 0x0036F}, {0x00483, 0x00489}, {0x00591, 0x005BD}, {0x005BF, 0x005BF},
+    {0x005C1, 0x005C2}, {0x005C4, 0x005C5}, {0x005C7, 0x005C7}, {0x00600, 0x00605},
+    {0x00610, 0x0061A}, {0x0061C, 0x0061C}, {0x0064B, 0x0065F}, {0x00670, 0x00670},
+    {0x006D6, 0x006DD}, {0x006DF, 0x006E4}, {0x006E7, 0x006E8}, {0x006EA, 0x006ED},
+    {0x0070F, 0x0070F}, {0x00711, 0x00711}, {0x00730, 0x0074A}, {0x007A6, 0x007B0},
+    {0x007EB, 0x007F3}, {0x007FD, 0x007FD}, {0x00816, 0x00819}, {0x0081B, 0x00823},
+    {0x00825, 0x00827}, {0x00829, 0x0082D}, {0x00859, 0x0085B}, {0x00890, 0x0089F},
+    {0x008CA, 0x00902}, {0x0093A, 0x0093A}, {0x0093C, 0x0093C}, {0x00941, 0x00948},
+    {0x0094D, 0x0094D}, {0x00951, 0x00957}, {0x00962, 0x00963}, {0x00981, 0x00981},
+    {0x009BC, 0x009BC}, {0x009C1, 0x009C4}, {0x009CD, 0x009CD}, {0x009E2, 0x009E3},
+    {0x009FE, 0x00A02}, {0x00A3C, 0x00A3C}, {0x00A41, 0x00A51}, {0x00A70, 0x00A71},
+    {0x00A75, 0x00A75}, {0x00A81, 0x00A82}, {0x00ABC, 0x00ABC}, {0x00AC1, 0x00AC8},
+    {0x00ACD, 0x00ACD}, {0x00AE2, 0x00AE3}, {0x00AFA, 0x00B01}, {0x00B3C, 0x00B3C},
+    {0x00B3F, 0x00B3F}, {0x00B41, 0x00B44}, {0x00B4D, 0x00B56}, {0x00B62, 0x00B63},
+    {0x00B82, 0x00B82}, {0x00BC0, 0x00BC0}, {0x00BCD, 0x00BCD}, {0x00C00, 0x00C00},
+    {0x00C04, 0x00C04}, {0x00C3C, 0x00C3C}, {0x00C3E, 0x00C40}, {0x00C46, 0x00C56},
+    {0x00C62, 0x00C63}, {0x00C81, 0x00C81}, {0x00CBC, 0x00CBC}, {0x00CBF, 0x00CBF},
+    {0x00CC6, 0x00CC6}, {0x00CCC, 0x00CCD}, {0x00CE2, 0x00CE3}, {0x00D00, 0x00D01},
+    {0x00D3B, 0x00D3C}, {0x00D41, 0x00D44}, {0x00D4D, 0x00D4D}, {0x00D62, 0x00D63},
+    {0x00D81, 0x00D81}, {0x00DCA, 0x00DCA}, {0x00DD2, 0x00DD6}, {0x00E31, 0x00E31},
+    {0x00E34, 0x00E3A}, {0x00E47, 0x00E4E}, {0x00EB1, 0x00EB1}, {0x00EB4, 0x00EBC},
+    {0x00EC8, 0x00ECD}, {0x00F18, 0x00F19}, {0x00F35, 0x00F35}, {0x00F37, 0x00F37},
+    {0x00F39, 0x00F39}, {0x00F71, 0x00F7E}, {0x00F80, 0x00F84}, {0x00F86, 0x00F87},
+    {0x00F8D, 0x00FBC}, {0x00FC6, 0x00FC6}, {0x0102D, 0x01030}, {0x01032, 0x01037},
+    {0x01039, 0x0103A}, {0x0103D, 0x0103E}, {0x01058, 0x01059}, {0x0105E, 0x01060},
+    {0x01071, 0x01074}, {0x01082, 0x01082}, {0x01085, 0x01086}, {0x0108D, 0x0108D},
+    {0x0109D, 0x0109D}, {0x01160, 0x011FF}, {0x0135D, 0x0135F}, {0x01712, 0x01714},
+    {0x01732, 0x01733}, {0x01752, 0x01753}, {0x01772, 0x01773}, {0x017B4, 0x017B5},
+    {0x017B7, 0x017BD}, {0x017C6, 0x017C6}, {0x017C9, 0x017D3}, {0x017DD, 0x017DD},
+    {0x0180B, 0x0180F}, {0x01885, 0x01886}, {0x018A9, 0x018A9}, {0x01920, 0x01922},
+    {0x01927, 0x01928}, {0x01932, 0x01932}, {0x01939, 0x0193B}, {0x01A17, 0x01A18},
+    {0x01A1B, 0x01A1B}, {0x01A56, 0x01A56}, {0x01A58, 0x01A60}, {0x01A62, 0x01A62},
+    {0x01A65, 0x01A6C}, {0x01A73, 0x01A7F}, {0x01AB0, 0x01B03}, {0x01B34, 0x01B34},
+    {0x01B36, 0x01B3A}, {0x01B3C, 0x01B3C}, {0x01B42, 0x01B42}, {0x01B6B, 0x01B73},
+    {0x01B80, 0x01B81}, {0x01BA2, 0x01BA5}, {0x01BA8, 0x01BA9}, {0x01BAB, 0x01BAD},
+    {0x01BE6, 0x01BE6}, {0x01BE8, 0x01BE9}, {0x01BED, 0x01BED}, {0x01BEF, 0x01BF1},
+    {0x01C2C, 0x01C33}, {0x01C36, 0x01C37}, {0x01CD0, 0x01CD2}, {0x01CD4, 0x01CE0},
+    {0x01CE2, 0x01CE8}, {0x01CED, 0x01CED}, {0x01CF4, 0x01CF4}, {0x01CF8, 0x01CF9},
+    {0x01DC0, 0x01DFF}, {0x0200B, 0x0200F}, {0x0202A, 0x0202E}, {0x02060, 0x0206F},
+    {0x020D0, 0x020F0}, {0x02CEF, 0x02CF1}, {0x02D7F, 0x02D7F}, {0x02DE0, 0x02DFF},
+    {0x0302A, 0x0302D}, {0x03099, 0x0309A}, {0x0A66F, 0x0A672}, {0x0A674, 0x0A67D},
+    {0x0A69E, 0x0A69F}, {0x0A6F0, 0x0A6F1}, {0x0A802, 0x0A802}, {0x0A806, 0x0A806},
+    {0x0A80B, 0x0A80B}, {0x0A825, 0x0A826}, {0x0A82C, 0x0A82C}, {0x0A8C4, 0x0A8C5},
+    {0x0A8E0, 0x0A8F1}, {0x0A8FF, 0x0A8FF}, {0x0A926, 0x0A92D}, {0x0A947, 0x0A951},
+    {0x0A980, 0x0A982}, {0x0A9B3, 0x0A9B3}, {0x0A9B6, 0x0A9B9}, {0x0A9BC, 0x0A9BD},
+    {0x0A9E5, 0x0A9E5}, {0x0AA29, 0x0AA2E}, {0x0AA31, 0x0AA32}, {0x0AA35, 0x0AA36},
+    {0x0AA43, 0x0AA43}, {0x0AA4C, 0x0AA4C}, {0x0AA7C, 0x0AA7C}, {0x0AAB0, 0x0AAB0},
+    {0x0AAB2, 0x0AAB4}, {0x0AAB7, 0x0AAB8}, {0x0AABE, 0x0AABF}, {0x0AAC1, 0x0AAC1},
+    {0x0AAEC, 0x0AAED}, {0x0AAF6, 0x0AAF6}, {0x0ABE5, 0x0ABE5}, {0x0ABE8, 0x0ABE8},
+    {0x0ABED, 0x0ABED}, {0x0FB1E, 0x0FB1E}, {0x0FE00, 0x0FE0F}, {0x0FE20, 0x0FE2F},
+    {0x0FEFF, 0x0FEFF}, {0x0FFF9, 0x0FFFB}, {0x101FD, 0x101FD}, {0x102E0, 0x102E0},
+    {0x10376, 0x1037A}, {0x10A01, 0x10A0F}, {0x10A38, 0x10A3F}, {0x10AE5, 0x10AE6},
+    {0x10D24, 0x10D27}, {0x10EAB, 0x10EAC}, {0x10F46, 0x10F50}, {0x10F82, 0x10F85},
+    {0x11001, 0x11001}, {0x11038, 0x11046}, {0x11070, 0x11070}, {0x11073, 0x11074},
+    {0x1107F, 0x11081}, {0x110B3, 0x110B6}, {0x110B9, 0x110BA}, {0x110BD, 0x110BD},
+    {0x110C2, 0x110CD}, {0x11100, 0x11102}, {0x11127, 0x1112B}, {0x1112D, 0x11134},
+    {0x11173, 0x11173}, {0x11180, 0x11181}, {0x111B6, 0x111BE}, {0x111C9, 0x111CC},
+    {0x111CF, 0x111CF}, {0x1122F, 0x11231}, {0x11234, 0x11234}, {0x11236, 0x11237},
+    {0x1123E, 0x1123E}, {0x112DF, 0x112DF}, {0x112E3, 0x112EA}, {0x11300, 0x11301},
+    {0x1133B, 0x1133C}, {0x11340, 0x11340}, {0x11366, 0x11374}, {0x11438, 0x1143F},
+    {0x11442, 0x11444}, {0x11446, 0x11446}, {0x1145E, 0x1145E}, {0x114B3, 0x114B8},
+    {0x114BA, 0x114BA}, {0x114BF, 0x114C0}, {0x114C2, 0x114C3}, {0x115B2, 0x115B5},
+    {0x115BC, 0x115BD}, {0x115BF, 0x115C0}, {0x115DC, 0x115DD}, {0x11633, 0x1163A},
+    {0x1163D, 0x1163D}, {0x1163F, 0x11640}, {0x116AB, 0x116AB}, {0x116AD, 0x116AD},
+    {0x116B0, 0x116B5}, {0x116B7, 0x116B7}, {0x1171D, 0x1171F}, {0x11722, 0x11725},
+    {0x11727, 0x1172B}, {0x1182F, 0x11837}, {0x11839, 0x1183A}, {0x1193B, 0x1193C},
+    {0x1193E, 0x1193E}, {0x11943, 0x11943}, {0x119D4, 0x119DB}, {0x119E0, 0x119E0},
+    {0x11A01, 0x11A0A}, {0x11A33, 0x11A38}, {0x11A3B, 0x11A3E}, {0x11A47, 0x11A47},
+    {0x11A51, 0x11A56}, {0x11A59, 0x11A5B}, {0x11A8A, 0x11A96}, {0x11A98, 0x11A99},
+    {0x11C30, 0x11C3D}, {0x11C3F, 0x11C3F}, {0x11C92, 0x11CA7}, {0x11CAA, 0x11CB0},
+    {0x11CB2, 0x11CB3}, {0x11CB5, 0x11CB6}, {0x11D31, 0x11D45}, {0x11D47, 0x11D47},
+    {0x11D90, 0x11D91}, {0x11D95, 0x11D95}, {0x11D97, 0x11D97}, {0x11EF3, 0x11EF4},
+    {0x13430, 0x13438}, {0x16AF0, 0x16AF4}, {0x16B30, 0x16B36}, {0x16F4F, 0x16F4F},
+    {0x16F8F, 0x16F92}, {0x16FE4, 0x16FE4}, {0x1BC9D, 0x1BC9E}, {0x1BCA0, 0x1CF46},
+    {0x1D167, 0x1D169}, {0x1D173, 0x1D182}, {0x1D185, 0x1D18B}, {0x1D1AA, 0x1D1AD},
+    {0x1D242, 0x1D244}, {0x1DA00, 0x1DA36}, {0x1DA3B, 0x1DA6C}, {0x1DA75, 0x1DA75},
+    {0x1DA84, 0x1DA84}, {0x1DA9B, 0x1DAAF}, {0x1E000, 0x1E02A}, {0x1E130, 0x1E136},
+    {0x1E2AE, 0x1E2AE}, {0x1E2EC, 0x1E2EF}, {0x1E8D0, 0x1E8D6}, {0x1E944, 0x1E94A},
+    {0xE0001, 0xE01EF},
+};
+
+static const struct widthRange wideTable[] = {
+    {0x01100, 0x0115F}, {0x0231A, 0x0231B}, {0x02329, 0x0232A}, {0x023E9, 0x023EC},
+    {0x023F0, 0x023F0}, {0x023F3, 0x023F3}, {0x025FD, 0x025FE}, {0x02614, 0x02615},
+    {0x02648, 0x02653}, {0x0267F, 0x0267F}, {0x02693, 0x02693}, {0x026A1, 0x026A1},
+    {0x026AA, 0x026AB}, {0x026BD, 0x026BE}, {0x026C4, 0x026C5}, {0x026CE, 0x026CE},
+    {0x026D4, 0x026D4}, {0x026EA, 0x026EA}, {0x026F2, 0x026F3}, {0x026F5, 0x026F5},
+    {0x026FA, 0x026FA}, {0x026FD, 0x026FD}, {0x02705, 0x02705}, {0x0270A, 0x0270B},
+    {0x02728, 0x02728}, {0x0274C, 0x0274C}, {0x0274E, 0x0274E}, {0x02753, 0x02755},
+    {0x02757, 0x02757}, {0x02795, 0x02797}, {0x027B0, 0x027B0}, {0x027BF, 0x027BF},
+    {0x02B1B, 0x02B1C}, {0x02B50, 0x02B50}, {0x02B55, 0x02B55}, {0x02E80, 0x03029},
+    {0x0302E, 0x0303E}, {0x03041, 0x03096}, {0x0309B, 0x03247}, {0x03250, 0x04DBF},
+    {0x04E00, 0x0A4C6}, {0x0A960, 0x0A97C}, {0x0AC00, 0x0D7A3}, {0x0F900, 0x0FAD9},
+    {0x0FE10, 0x0FE19}, {0x0FE30, 0x0FE6B}, {0x0FF01, 0x0FF60}, {0x0FFE0, 0x0FFE6},
+    {0x16FE0, 0x16FE3}, {0x16FF0, 0x1B2FB}, {0x1F004, 0x1F004}, {0x1F0CF, 0x1F0CF},
+    {0x1F18E, 0x1F18E}, {0x1F191, 0x1F19A}, {0x1F200, 0x1F320}, {0x1F32D, 0x1F335},
+    {0x1F337, 0x1F37C}, {0x1F37E, 0x1F393}, {0x1F3A0, 0x1F3CA}, {0x1F3CF, 0x1F3D3},
+    {0x1F3E0, 0x1F3F0}, {0x1F3F4, 0x1F3F4}, {0x1F3F8, 0x1F43E}, {0x1F440, 0x1F440},
+    {0x1F442, 0x1F4FC}, {0x1F4FF, 0x1F53D}, {0x1F54B, 0x1F54E}, {0x1F550, 0x1F567},
+    {0x1F57A, 0x1F57A}, {0x1F595, 0x1F596}, {0x1F5A4, 0x1F5A4}, {0x1F5FB, 0x1F64F},
+    {0x1F680, 0x1F6C5}, {0x1F6CC, 0x1F6CC}, {0x1F6D0, 0x1F6D2}, {0x1F6D5, 0x1F6DF},
+    {0x1F6EB, 0x1F6EC}, {0x1F6F4, 0x1F6FC}, {0x1F7E0, 0x1F7F0}, {0x1F90C, 0x1F93A},
+    {0x1F93C, 0x1F945}, {0x1F947, 0x1F9FF}, {0x1FA70, 0x1FAF6}, {0x20000, 0x3FFFD},
+};
+
+#define TABLE_SIZE(t) ((int)(sizeof(t) / sizeof(t[0])))
+
+int widthTableHas(const struct widthRange* table, int size, int cp) {
+    int lo = 0, hi = size - 1;
+    if(cp < (int)table[0].first || cp > (int)table[hi].last) return 0;
+    while(lo <= hi) {
+        int mid = (lo + hi) / 2;
+        if(cp > (int)table[mid].last) {
+            lo = mid + 1;
+        }else if(cp < (int)table[mid].first) {
+            hi = mid - 1;
+        }else {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int unicodeTableWidth(int cp) {
+    if(widthTableHas(zeroWidthTable, TABLE_SIZE(zeroWidthTable), cp)) return 0;
+    if(widthTableHas(wideTable, TABLE_SIZE(wideTable), cp)) return 2;
+    return 1;
+}
+
+// nearly everything on screen is in the basic multilingual plane, so its widths are expanded from the
+// range tables into one flat 64K table the first time they're needed, and looking one up is an index
+unsigned char bmpWidth[0x10000];
+int bmpWidthReady = 0;
+
+// has to run before any threads render rows, since they'd all try to fill the table at once
+void unicodeBuildBmpTable() {
+    if(bmpWidthReady) return;
+    for(int i = 0; i < 0x10000; i++) {
+        bmpWidth[i] = i < 0x300 ? 1 : unicodeTableWidth(i);
+    }
+    bmpWidthReady = 1;
+}
+
+// screen columns taken by a code point, invalid bytes (cp < 0) are shown as a single '?'
+int unicodeWidth(int cp) {
+    if(cp < 0x300) return 1;
+    if(cp >= 0x10000) return unicodeTableWidth(cp);
+
+    unicodeBuildBmpTable();
+    return bmpWidth[cp];
+}
+
+// decodes the UTF-8 sequence at s and returns how many bytes it used
+// anything malformed (bad lead byte, missing continuation, overlong, surrogate) is one byte with *cp = -1
+int utf8Decode(const char* s, int len, int* cp) {
+    unsigned char c = s[0];
+    int n, value;
+    if(c < 0x80) {
+        *cp = c;
+        return 1;
+    }else if(c >= 0xC2 && c <= 0xDF) {
+        n = 2;
+        value = c & 0x1F;
+    }else if(c >= 0xE0 && c <= 0xEF) {
+        n = 3;
+        value = c & 0x0F;
+    }else if(c >= 0xF0 && c <= 0xF4) {
+        n = 4;
+        value = c & 0x07;
+    }else {
+        *cp = -1;
+        return 1;
+    }
+
+    if(n > len) {
+        *cp = -1;
+        return 1;
+    }
+    for(int i = 1; i < n; i++) {
+        unsigned char cont = s[i];
+        if((cont & 0xC0) != 0x80) {
+            *cp = -1;
+            return 1;
+        }
+        value = (value << 6) | (cont & 0x3F);
+    }
+
+    if((n == 3 && value < 0x800) || (n == 4 && (value < 0x10000 || value > 0x10FFFF)) ||
+            (value >= 0xD800 && value <= 0xDFFF)) {
+        *cp = -1;
+        return 1;
+    }
+    *cp = value;
+    return n;
+}
+
+// returns how many bytes the grapheme cluster at s takes, and how many columns it is in *width
+int utf8Cluster(const char* s, int len, int* width) {
+    int cp;
+    int n = utf8Decode(s, len, &cp);
+    *width = cp < 0 ? 1 : unicodeWidth(cp);
+    if(cp < 0 || n == len || (unsigned char)s[n] < 0x80) return n;
+
+    int joined = cp == 0x200D;
+    while(n < len && (unsigned char)s[n] >= 0x80) {
+        int next;
+        int m = utf8Decode(&s[n], len - n, &next);
+        if(next < 0) break;
+        if(!joined && unicodeWidth(next) != 0) break;
+        joined = next == 0x200D;
+        n += m;
+    }
+    return n;
+}
+
 /*----------------------------------------------SYNTAX HIGHLIGHTING---------------------------------------------*/
 
-// updates the hl array of the given row so that it contains the right syntax highlighting
-void editorUpdateSyntax(erow* row) {
-    row->hl = realloc(row->hl, row->rsize);
-    memset(row->hl, HL_NORMAL, row->rsize);
+// adds a keyword or comment start to the DFA, which is really a trie over character classes:
+// every new prefix gets a new state, and the state at the end of the word accepts it
+void syntaxAddToken(struct editorSyntax* syn, const char* word, int kind) {
+    int state = 1;
+    for(const unsigned char* p = (const unsigned char*)word; *p; p++) {
+        int at = state * syn->numClasses + syn->charclass[*p];
+        if(syn->transitions[at] == 0) {
+            int n = syn->numStates++;
+            syn->transitions = realloc(syn->transitions, sizeof(int) * syn->numStates * syn->numClasses);
+            memset(&syn->transitions[n * syn->numClasses], 0, sizeof(int) * syn->numClasses);
+            syn->accept = realloc(syn->accept, syn->numStates);
+            syn->accept[n] = TOK_NONE;
+            syn->transitions[at] = n;
+        }
+        state = syn->transitions[at];
+    }
+    if(syn->accept[state] == TOK_NONE) syn->accept[state] = kind;
+}
 
-    if(E.syntax == NULL) return;
+void editorFreeSyntax(struct editorSyntax* syn) {
+    free(syn->filetype);
+    for(int i = 0; i < syn->numFilematch; i++) free(syn->filematch[i]);
+    free(syn->filematch);
+    free(syn->block_comment_end);
+    free(syn->transitions);
+    free(syn->accept);
+    memset(syn, 0, sizeof(*syn));
+}
 
-    char** keywords = E.syntax->keywords;
-    char* scs = E.syntax->singleline_comment_start;
-    int scs_len = scs ? strlen(scs) : 0;
+// reads the text of a .syntax file into syn and compiles its lexer, every line is a directive
+// followed by its words, see syntax/c.syntax; returns -1 and fills in err if something is wrong,
+// with nothing left allocated in syn
+int editorParseSyntax(struct editorSyntax* syn, char* text, char* err, size_t errlen) {
+    memset(syn, 0, sizeof(*syn));
+    syn->escape = '\\';
+
+    //the words for the DFA are collected first, because the character classes have to be known before building it
+    char** words = NULL;
+    unsigned char* kinds = NULL;
+    int numWords = 0;
+
+    int lineno = 0;
+    char* saveline;
+    for(char* line = strtok_r(text, "\n", &saveline); line; line = strtok_r(NULL, "\n", &saveline)) {
+        lineno++;
+        char* saveword;
+        char* directive = strtok_r(line, " \t\r", &saveword);
+        if(directive == NULL || directive[0] == '#') continue;
+
+        char* args[HEAT_SYNTAX_ARGS];
+        int argc = 0;
+        char* word;
+        while((word = strtok_r(NULL, " \t\r", &saveword)) != NULL) {
+            if(argc == HEAT_SYNTAX_ARGS) {
+                snprintf(err, errlen, "line %d: more than %d words, %s can be given again on the next line", lineno, HEAT_SYNTAX_ARGS, directive);
+                goto fail;
+            }
+            args[argc++] = word;
+        }
 
-    int in_string = 0;              // keep track where in string
-    for(int i = 0; i < row->rsize; i++) {
-        char c = row->render[i];
+        int kind = TOK_NONE;
+        if(!strcmp(directive, "filetype") && argc == 1) {
+            free(syn->filetype);
+            syn->filetype = strdup(args[0]);
+        }else if(!strcmp(directive, "extensions")) {
+            syn->filematch = realloc(syn->filematch, sizeof(char*) * (syn->numFilematch + argc));
+            for(int i = 0; i < argc; i++) syn->filematch[syn->numFilematch++] = strdup(args[i]);
+        }else if(!strcmp(directive, "keywords")) {
+            kind = TOK_KEYWORD1;
+        }else if(!strcmp(directive, "types")) {
+            kind = TOK_KEYWORD2;
+        }else if(!strcmp(directive, "comment")) {
+            kind = TOK_COMMENT;
+        }else if(!strcmp(directive, "block_comment") && argc == 2) {
+            free(syn->block_comment_end);
+            syn->block_comment_end = strdup(args[1]);
+            kind = TOK_BLOCK_COMMENT;
+            argc = 1;
+        }else if(!strcmp(directive, "strings")) {
+            syn->flags |= HL_HIGHLIGHT_STRINGS;
+            for(int i = 0; i < argc; i++) syn->stringDelim[(unsigned char)args[i][0]] = 1;
+        }else if(!strcmp(directive, "escape") && argc == 1) {
+            syn->escape = args[0][0];
+        }else if(!strcmp(directive, "numbers")) {
+            syn->flags |= HL_HIGHLIGHT_NUMBERS;
+            for(int i = 0; i < argc; i++) {
+                const char* body = NULL;
+                if(!strcmp(args[i], "decimal")) body = "0123456789uUlL";
+                else if(!strcmp(args[i], "float")) body = "0123456789.eEfF";
+                else if(!strcmp(args[i], "hex")) body = "0123456789xXabcdefABCDEF";
+                else if(!strcmp(args[i], "binary")) body = "01bB";
+                else {
+                    snprintf(err, errlen, "line %d: unknown number format %s", lineno, args[i]);
+                    goto fail;
+                }
+                for(const char* b = body; *b; b++) syn->numberBody[(unsigned char)*b] = 1;
+            }
+            for(int c = '0'; c <= '9'; c++) syn->numberStart[c] = 1;
+        }else {
+            snprintf(err, errlen, "line %d: don't know what to do with %s", lineno, directive);
+            goto fail;
+        }
 
-        // comment
-        if(scs_len && !in_string) {
-            if(!strncmp(&row->render[i], scs, scs_len)) {
-                memset(&row->hl[i], HL_COMMENT, row->rsize - i);
-                break;
+        if(kind != TOK_NONE) {
+            words = realloc(words, sizeof(char*) * (numWords + argc));
+            kinds = realloc(kinds, numWords + argc);
+            for(int i = 0; i < argc; i++) {
+                words[numWords] = args[i];
+                kinds[numWords++] = kind;
+            }
+        }
+    }
+
+    if(syn->filetype == NULL) {
+        snprintf(err, errlen, "no filetype");
+        goto fail;
+    }
+
+    //keywords and numbers have to stand on their own, between these
+    for(const char* sep = ",.()+-/*=~%<>[];{}&|!^?:"; *sep; sep++) {
+        syn->separator[(unsigned char)*sep] = 1;
+    }
+    for(int c = 0; c < 256; c++) {
+        if(c == 0 || isspace(c) || syn->stringDelim[c]) syn->separator[c] = 1;
+    }
+
+    //every byte that shows up in a word gets a class of its own, all the other bytes share class 0
+    syn->numClasses = 1;
+    for(int i = 0; i < numWords; i++) {
+        for(unsigned char* p = (unsigned char*)words[i]; *p; p++) {
+            if(syn->charclass[*p] == 0) syn->charclass[*p] = syn->numClasses++;
+        }
+    }
+    syn->numStates = 2;
+    syn->transitions = calloc(syn->numStates * syn->numClasses, sizeof(int));
+    syn->accept = calloc(syn->numStates, 1);
+    for(int i = 0; i < numWords; i++) {
+        syntaxAddToken(syn, words[i], kinds[i]);
+    }
+
+    free(words);
+    free(kinds);
+    return 0;
+
+fail:
+    free(words);
+    free(kinds);
+    editorFreeSyntax(syn);
+    return -1;
+}
+
+// runs the lexer over one rendered row, filling in its hl, starting in the state the row before it ended in
+// only touches r, so rows can be highlighted on any thread; returns the state at the end of the row
+int editorHighlightRow(struct rowRender* r, struct editorSyntax* syn, int state) {
+    memset(r->hl, HL_NORMAL, r->rsize);
+
+    if(syn == NULL) return HL_STATE_NORMAL;
+
+    unsigned char* render = (unsigned char*)r->render;
+    unsigned char* hl = r->hl;
+    int rsize = r->rsize;
+    char* bce = syn->block_comment_end;
+    int bce_len = bce ? strlen(bce) : 0;
+
+    int prev_sep = 1;               // whether the character before i is a separator
+    int in_string = 0;              // keep track where in string
+    int i = 0;
+    while(i < rsize) {
+        unsigned char c = render[i];
+
+        // inside a block comment, look for where it ends
+        if(state == HL_STATE_COMMENT) {
+            hl[i] = HL_COMMENT;
+            if(bce_len && c == (unsigned char)bce[0] && !strncmp((char*)&render[i], bce, bce_len)) {
+                memset(&hl[i], HL_COMMENT, bce_len);
+                i += bce_len;
+                state = HL_STATE_NORMAL;
+                prev_sep = 1;
+                continue;
             }
+            i++;
+            continue;
         }
 
         // string
-        if(E.syntax->flags & HL_HIGHLIGHT_STRINGS) {
-            if(in_string) {
-                row->hl[i] = HL_STRING;
-                if(c == '\\' && i + 1 < row->rsize)  {
-                    row->hl[i + 1] = HL_STRING;
-                    i++;
-                    continue;
-                }
-                if(c == in_string) in_string = 0;
+        if(in_string) {
+            hl[i] = HL_STRING;
+            if(c == syn->escape && i + 1 < rsize)  {
+                hl[i + 1] = HL_STRING;
+                i += 2;
                 continue;
-            }else {
-                if(c == '"' || c == '\'') {
-                    in_string = c;
-                    row->hl[i] = HL_STRING;
-                    continue;
-                }
             }
+            if(c == in_string) in_string = 0;
+            i++;
+            prev_sep = 1;
+            continue;
+        }
+        if((syn->flags & HL_HIGHLIGHT_STRINGS) && syn->stringDelim[c]) {
+            in_string = c;
+            hl[i++] = HL_STRING;
+            continue;
         }
 
         // number
-        if(E.syntax->flags & HL_HIGHLIGHT_NUMBERS) {
-            if(isdigit(c)) {
-                row->hl[i] = HL_NUMBER;
-            }
+        if((syn->flags & HL_HIGHLIGHT_NUMBERS) && prev_sep && syn->numberStart[c]) {
+            int end = i + 1;
+            while(end < rsize && syn->numberBody[render[end]]) end++;
+            memset(&hl[i], HL_NUMBER, end - i);
+            i = end;
+            prev_sep = 0;
+            continue;
         }
-        
 
-        // keywords
-        for(int j = 0; keywords[j]; j++) {
-            int klen = strlen(keywords[j]);
-            int kw2 = keywords[j][klen - 1] == '|';
-            if(kw2) klen--;
+        // keywords and comments: run the DFA as far as it goes and keep the longest token that fits,
+        // keywords only count if they aren't part of a longer word
+        int dfa = 1, token = TOK_NONE, token_end = i;
+        for(int j = i; j < rsize; j++) {
+            dfa = syn->transitions[dfa * syn->numClasses + syn->charclass[render[j]]];
+            if(dfa == 0) break;
+
+            int kind = syn->accept[dfa];
+            if(kind == TOK_COMMENT || kind == TOK_BLOCK_COMMENT ||
+                    (kind != TOK_NONE && prev_sep && (j + 1 == rsize || syn->separator[render[j + 1]]))) {
+                token = kind;
+                token_end = j + 1;
+            }
+        }
 
-            if (!strncmp(&row->render[i], keywords[j], klen)) {
-                memset(&row->hl[i], kw2 ? HL_KEYWORD2 : HL_KEYWORD1, klen);
-                i += klen;
-                break;
-            }   
+        if(token == TOK_COMMENT) {
+            memset(&hl[i], HL_COMMENT, rsize - i);
+            break;
+        }else if(token == TOK_BLOCK_COMMENT) {
+            memset(&hl[i], HL_COMMENT, token_end - i);
+            state = HL_STATE_COMMENT;
+            i = token_end;
+            continue;
+        }else if(token != TOK_NONE) {
+            memset(&hl[i], token == TOK_KEYWORD2 ? HL_KEYWORD2 : HL_KEYWORD1, token_end - i);
+            i = token_end;
+            prev_sep = 0;
+            continue;
         }
+
+        prev_sep = syn->separator[c];
+        i++;
+    }
+
+    return state;
+}
+
+// works out the state the row ends in now that the one before it changed (like opening a block comment),
+// and carries on down the file for as long as that changes the state too; the rows it passes lose their
+// cached render, they get highlighted again the next time they're drawn
+void editorUpdateSyntax(erow* row) {
+    struct rowRender scratch = {NULL, NULL, 0, 0};
+    erow* end = &E.row[E.numRows];
+    while(row < end) {
+        int in = row > E.row ? row[-1].hlstate : HL_STATE_NORMAL;
+        int out = editorRowRefresh(row, in, &scratch);
+        int changed = row->hlstate != out;
+        row->hlstate = out;
+        if(!changed) break;
+        row++;
     }
+    editorFreeRender(&scratch);
 }
 
 // returns the color that corresponds to the type given
@@ -348,120 +1383,525 @@ int editorSyntaxToColor(int hl) {
     }
 }
 
-// checks if the filetype is one in the filematch array, and sets E.syntax accordingly
-// loops through the HLDB entries and finds whichever file extension it can match to
-void editorSelectSyntaxHighlight() {
-    E.syntax = NULL;
-    if (E.filename == NULL) return;
-    char *ext = strrchr(E.filename, '.');
-    for (unsigned int j = 0; j < HLDB_ENTRIES; j++) {
-        struct editorSyntax *s = &HLDB[j];
-        unsigned int i = 0;
-        while (s->filematch[i]) {
-            int is_ext = (s->filematch[i][0] == '.');
-            if ((is_ext && ext && !strcmp(ext, s->filematch[i])) ||
-                (!is_ext && strstr(E.filename, s->filematch[i]))) {
-                E.syntax = s;
-
-                for(int filerow = 0; filerow < E.numRows; filerow++) {
-                    editorUpdateSyntax(&E.row[filerow]);
-                }
+// FNV-1a, good enough for a handful of short extensions
+unsigned int extensionHash(const char* ext) {
+    unsigned int h = 2166136261u;
+    for(; *ext; ext++) {
+        h = (h ^ (unsigned char)*ext) * 16777619u;
+    }
+    return h;
+}
 
-                return;
+// puts every extension of every language into the hash map, the first language to claim one keeps it
+void editorBuildExtensionMap() {
+    int count = 0;
+    for(int j = 0; j < hldbEntries; j++) count += HLDB[j].numFilematch;
+
+    free(extensionMap);
+    extensionMapSize = 16;
+    while(extensionMapSize < count * 2) extensionMapSize *= 2;
+    extensionMap = calloc(extensionMapSize, sizeof(struct extensionSlot));
+
+    for(int j = 0; j < hldbEntries; j++) {
+        for(int i = 0; i < HLDB[j].numFilematch; i++) {
+            char* ext = HLDB[j].filematch[i];
+            if(ext[0] != '.') continue;
+            unsigned int slot = extensionHash(ext) & (extensionMapSize - 1);
+            while(extensionMap[slot].ext && strcmp(extensionMap[slot].ext, ext)) {
+                slot = (slot + 1) & (extensionMapSize - 1);
+            }
+            if(extensionMap[slot].ext == NULL) {
+                extensionMap[slot].ext = ext;
+                extensionMap[slot].syntax = j;
             }
-            i++;
         }
     }
 }
 
-/*-------------------------------------------------ROW OPERATIONS-----------------------------------------------*/
+// looks up the language for a file: its extension goes through the hash map, and only the few
+// patterns that aren't extensions (like "Makefile") are checked one by one
+struct editorSyntax* editorFindSyntax(const char* filename) {
+    if(filename == NULL || extensionMap == NULL) return NULL;
+
+    const char* ext = strrchr(filename, '.');
+    if(ext) {
+        unsigned int slot = extensionHash(ext) & (extensionMapSize - 1);
+        while(extensionMap[slot].ext) {
+            if(!strcmp(extensionMap[slot].ext, ext)) return &HLDB[extensionMap[slot].syntax];
+            slot = (slot + 1) & (extensionMapSize - 1);
+        }
+    }
 
-//calculates the render position correctly in the tabs
-int editorRowCursorXToRx(erow* row, int cx) {
-    int rx = 0;
-    int j;
-    for(j = 0; j < cx; j++) {
-        if(row->chars[j] == '\t') {
-            rx += (HEAT_TAB_STOP - 1) - (rx % HEAT_TAB_STOP);
+    for(int j = 0; j < hldbEntries; j++) {
+        for(int i = 0; i < HLDB[j].numFilematch; i++) {
+            if(HLDB[j].filematch[i][0] != '.' && strstr(filename, HLDB[j].filematch[i])) return &HLDB[j];
         }
-        rx++;
     }
-    return rx;
+    return NULL;
 }
 
-void editorUpdateRow(erow* row) {
-    int tabs = 0;
-    int i = 0;
+// checks if the filetype is one we know, and sets E.syntax accordingly
+void editorSelectSyntaxHighlight() {
+    E.syntax = editorFindSyntax(E.filename);
+    editorHighlightRows();
+}
 
-    for(i = 0; i < row->size; i++) {
-        if(row->chars[i] == '\t') {
-            tabs++;
+// adds a language to HLDB, replacing one with the same filetype so files can override the built in C
+void editorAddSyntax(struct editorSyntax* syn) {
+    for(int j = 0; j < hldbEntries; j++) {
+        if(!strcmp(HLDB[j].filetype, syn->filetype)) {
+            editorFreeSyntax(&HLDB[j]);
+            HLDB[j] = *syn;
+            return;
         }
     }
+    HLDB = realloc(HLDB, sizeof(struct editorSyntax) * (hldbEntries + 1));
+    HLDB[hldbEntries++] = *syn;
+}
 
-    free(row->render);
-    row->render = malloc(row->size + tabs*(HEAT_TAB_STOP - 1) + 1);
+// loads every .syntax file from one directory, returns how many were broken
+int editorLoadSyntaxDir(const char* dir, char* err, size_t errlen) {
+    DIR* d = opendir(dir);
+    if(d == NULL) return 0;
+
+    int broken = 0;
+    struct dirent* ent;
+    while((ent = readdir(d)) != NULL) {
+        size_t len = strlen(ent->d_name);
+        if(len < 8 || strcmp(&ent->d_name[len - 7], ".syntax")) continue;
+
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/%s", dir, ent->d_name);
+        FILE* fp = fopen(path, "r");
+        if(!fp) continue;
+
+        char* text = NULL;
+        size_t cap = 0;
+        ssize_t n = getdelim(&text, &cap, '\0', fp);
+        fclose(fp);
+        if(n <= 0) {
+            free(text);
+            continue;
+        }
 
-    int idx = 0;
-    for(i = 0; i < row->size; i++) {
-        if(row->chars[i] == '\t') {
-            row->render[idx++] = ' ';
-            while(idx % HEAT_TAB_STOP != 0) {
-                row->render[idx++] = ' ';
-            }
-        }else {
-            row->render[idx++] = row->chars[i];
+        struct editorSyntax syn;
+        char why[128];
+        if(editorParseSyntax(&syn, text, why, sizeof(why)) == 0) {
+            editorAddSyntax(&syn);
+        }else if(broken++ == 0) {
+            snprintf(err, errlen, "%s: %s", path, why);
         }
+        free(text);
+    }
+    closedir(d);
+    return broken;
+}
+
+// builds HLDB at startup: the built in C first, then the directory make install copied syntax/ to, the
+// syntax folder next to the executable (so a build in the source tree finds it), $HEAT_SYNTAX_DIR and
+// ~/.heat/syntax; a later file with the same filetype replaces an earlier one, and adding a language is just
+// dropping a file in one of them; returns how many files couldn't be read
+int editorLoadSyntaxes(char* err, size_t errlen) {
+    struct editorSyntax syn;
+    char* builtin = strdup(HEAT_BUILTIN_SYNTAX);
+    char why[128];
+    if(editorParseSyntax(&syn, builtin, why, sizeof(why)) == 0) editorAddSyntax(&syn);
+    free(builtin);
+
+    char here[4096], home[4096];
+    ssize_t len = readlink("/proc/self/exe", here, sizeof(here) - 8);
+    char* slash = len > 0 ? memrchr(here, '/', len) : NULL;
+    if(slash) strcpy(slash, "/syntax");
+    if(getenv("HOME")) snprintf(home, sizeof(home), "%s/.heat/syntax", getenv("HOME"));
+
+    const char* dirs[] = {HEAT_SYNTAX_DIR, slash ? here : NULL, getenv("HEAT_SYNTAX_DIR"), getenv("HOME") ? home : NULL};
+    int broken = 0;
+    for(int i = 0; i < 4; i++) {
+        if(dirs[i] == NULL) continue;
+        broken += editorLoadSyntaxDir(dirs[i], broken ? why : err, broken ? sizeof(why) : errlen);
     }
 
-    row->render[idx] = '\0';
-    row->rsize = idx;
+    editorBuildExtensionMap();
+    return broken;
+}
+
+/*-------------------------------------------------LINE NUMBERS------------------------------------------------*/
 
-    editorUpdateSyntax(row);
+// the gutter is just wide enough for the biggest line number plus a space
+int editorGutterWidth() {
+    if(!E.gutter || E.hex) return 0;
+    int digits = 1;
+    for(int n = E.numRows; n >= 10; n /= 10) digits++;
+    return digits + 1;
 }
 
-void editorFreeRow(erow* row) {
-    free(row->render);
-    free(row->chars);
-    free(row->hl);
+// how many columns are left for the text itself
+int editorTextCols() {
+    int cols = E.cols - editorGutterWidth();
+    return cols > 0 ? cols : 1;
 }
 
-void editorDelRow(int at) {
-    if(at < 0 || at >= E.numRows) return;
+/*--------------------------------------------------SOFT WRAP--------------------------------------------------*/
 
-    editorFreeRow(&E.row[at]);
-    memmove(&E.row[at], &E.row[at + 1], sizeof(erow) * (E.numRows - at - 1));
-    E.numRows--;
-    E.dirty++;
+// when wrapping, every row takes up vlines screen lines, and a segment tree over those counts (laid out
+// like the bracket tree) gives the visual line where any row starts, or the row at any visual line, in O(log n)
+// editing a row only adjusts the tree along one path; inserting or deleting rows moves the leaves after it
+// along and adds the nodes above them up again, the whole tree is only built again when it runs out of leaves
+
+int editorWrapWidth() {
+    return editorTextCols();
 }
 
-//reallocates the entire text so it uses more memory (# characters in each row, multiplied by # rows)
-//set the at at the row we're looking at
-void editorInsertRow(int at, char* s, size_t length) {
-    if(at < 0 || at > E.numRows) return;
-    E.row = realloc(E.row, sizeof(erow) * (E.numRows + 1));
-    memmove(&E.row[at + 1], &E.row[at], sizeof(erow) * (E.numRows - at));
+// always at least one line, and there's room after the last character for the cursor
+int editorRowVisualLines(erow* row, int width) {
+    return row->rwidth / width + 1;
+}
 
-    //using row[at] because now row is a pointer to an erow, so dereference to see which part of row it is
-    E.row[at].size = length;
-    //malloc just allocates the memory needed, then memcpy copies the line into the erow
-    E.row[at].chars = malloc(length + 1);    
-    memcpy(E.row[at].chars, s, length);
-    E.row[at].chars[length] = '\0';
+void editorWrapBuild() {
+    int width = editorWrapWidth();
+    int n = E.numRows;
+    int size = editorBracketSize(n);
+
+    free(E.wraptree);
+    E.wraptree = calloc(2 * size, sizeof(int));
+    if(E.wraptree == NULL) die("calloc");
+    for(int i = 0; i < n; i++) {
+        E.row[i].vlines = editorRowVisualLines(&E.row[i], width);
+        E.wraptree[size + i] = E.row[i].vlines;
+    }
+    for(int k = size - 1; k > 0; k--) {
+        E.wraptree[k] = E.wraptree[2 * k] + E.wraptree[2 * k + 1];
+    }
 
-    E.row[at].rsize = 0;
-    E.row[at].render = NULL;
-    E.row[at].hl = NULL;
-    editorUpdateRow(&E.row[at]);
+    E.wrapRows = n;
+    E.wrapSize = size;
+    E.wrapWidth = width;
+    E.wrapStale = 0;
+}
 
-    E.numRows++;
-    E.dirty++;
+// makes sure the tree matches the current rows and screen width
+void editorWrapEnsure() {
+    if(E.wraptree == NULL || E.wrapStale || E.wrapRows != E.numRows || E.wrapWidth != editorWrapWidth()) {
+        editorWrapBuild();
+    }
 }
 
-// inserts a character into erow "row" at a position "at"
+// called whenever a row's render changes, only touches the tree if it is still up to date
+void editorWrapUpdateRow(erow* row) {
+    int at = row - E.row;
+    int width = editorWrapWidth();
+    int lines = editorRowVisualLines(row, width);
+    int delta = lines - row->vlines;
+    row->vlines = lines;
+
+    if(E.wraptree == NULL || E.wrapStale || E.wrapWidth != width) return;
+    if(at < 0 || at >= E.wrapRows || delta == 0) return;
+    for(int k = E.wrapSize + at; k > 0; k /= 2) {
+        E.wraptree[k] += delta;
+    }
+}
+
+// adds the nodes above leaves lo to hi - 1 up again, after those leaves changed
+void editorWrapRejoin(int lo, int hi) {
+    if(lo >= hi) return;
+    lo += E.wrapSize;
+    hi += E.wrapSize - 1;
+    for(lo /= 2, hi /= 2; lo > 0; lo /= 2, hi /= 2) {
+        for(int k = lo; k <= hi; k++) {
+            E.wraptree[k] = E.wraptree[2 * k] + E.wraptree[2 * k + 1];
+        }
+    }
+}
+
+// the n rows at "at" were replaced by the m rows that are there now, inserting is n = 0 and deleting is m = 0:
+// same as editorBracketReplace, the new rows get their vlines here so a later editorWrapUpdateRow only has
+// to apply the difference
+void editorWrapReplace(int at, int n, int m) {
+    if(E.wraptree == NULL || E.wrapStale || at + n > E.wrapRows) return;
+    int old = E.wrapRows, rows = old - n + m;
+    if(rows > E.wrapSize) {
+        E.wrapStale = 1;
+        return;
+    }
+    int* leaf = &E.wraptree[E.wrapSize];
+    memmove(&leaf[at + m], &leaf[at + n], sizeof(int) * (old - at - n));
+    for(int i = at; i < at + m; i++) {
+        E.row[i].vlines = editorRowVisualLines(&E.row[i], E.wrapWidth);
+        leaf[i] = E.row[i].vlines;
+    }
+    if(rows < old) memset(&leaf[rows], 0, sizeof(int) * (old - rows));
+    E.wrapRows = rows;
+    editorWrapRejoin(at, n == m ? at + m : rows > old ? rows : old);
+}
+
+// visual line where row "at" starts, which is the sum of vlines over the rows before it
+int editorWrapRowStart(int at) {
+    editorWrapEnsure();
+    if(at >= E.wrapRows) return E.wraptree[1];
+    int sum = 0;
+    //every left edge of the range that is a right child takes in its left sibling on the way up
+    for(int k = E.wrapSize + at; k > 1; k /= 2) {
+        if(k & 1) sum += E.wraptree[k - 1];
+    }
+    return sum;
+}
+
+// finds the row that visual line v falls in and which of its segments it is
+// returns E.numRows if v is past the end of the file
+int editorWrapFind(int v, int* seg) {
+    editorWrapEnsure();
+    if(v >= E.wraptree[1]) {
+        *seg = v - E.wraptree[1];
+        return E.wrapRows;
+    }
+
+    //walks down the tree, going right past every left subtree that still ends at or before v
+    int k = 1;
+    while(k < E.wrapSize) {
+        if(E.wraptree[2 * k] <= v) {
+            v -= E.wraptree[2 * k];
+            k = 2 * k + 1;
+        }else {
+            k = 2 * k;
+        }
+    }
+    *seg = v;
+    return k - E.wrapSize;
+}
+
+void editorToggleWrap() {
+    E.wrap = !E.wrap;
+    E.coloff = 0;
+    if(E.hex) {
+        E.voff = E.rowoff;              //hex lines always fit, so the view just stays where it is
+    }else if(E.wrap) {
+        E.voff = editorWrapRowStart(E.rowoff);
+    }else {
+        int seg;
+        E.rowoff = editorWrapFind(E.voff, &seg);
+    }
+    editorSetStatusMessage("Soft wrap %s", E.wrap ? "on" : "off");
+}
+
+/*-------------------------------------------------ROW OPERATIONS-----------------------------------------------*/
+
+//calculates the render position correctly in the tabs and wide characters
+int editorRowCursorXToRx(erow* row, int cx) {
+    char* chars = editorRowText(row, &CS.view);
+    int rx = 0;
+    int j = 0;
+    while(j < cx) {
+        unsigned char c = chars[j];
+        if(c == '\t') {
+            rx += (HEAT_TAB_STOP - 1) - (rx % HEAT_TAB_STOP);
+        }
+        if(c < 0x80) {
+            rx++;
+            j++;
+        }else {
+            int width;
+            j += utf8Cluster(&chars[j], row->size - j, &width);
+            rx += width;
+        }
+    }
+    return rx;
+}
+
+// the other way around, finds the cluster that covers screen column rx
+int editorRowRxToCx(erow* row, int rx) {
+    char* chars = editorRowText(row, &CS.view);
+    int cur = 0;
+    int cx = 0;
+    while(cx < row->size) {
+        unsigned char c = chars[cx];
+        int width = 1, len = 1;
+        if(c == '\t') {
+            width = HEAT_TAB_STOP - (cur % HEAT_TAB_STOP);
+        }else if(c >= 0x80) {
+            len = utf8Cluster(&chars[cx], row->size - cx, &width);
+        }
+        if(cur + width > rx) break;
+        cur += width;
+        cx += len;
+    }
+    return cx;
+}
+
+// start of the cluster after the one at "at"
+int editorRowNextCluster(erow* row, int at) {
+    if(at >= row->size) return row->size;
+    char* chars = editorRowText(row, &CS.view);
+    if((unsigned char)chars[at] < 0x80 && (at + 1 == row->size || (unsigned char)chars[at + 1] < 0x80)) return at + 1;
+    int width;
+    return at + utf8Cluster(&chars[at], row->size - at, &width);
+}
+
+// start of the cluster before "at"; ASCII always starts a cluster (marks after it join it, not the
+// other way round), so back up to the nearest one and walk forward from there instead of from the start of the row
+int editorRowPrevCluster(erow* row, int at) {
+    if(at <= 0) return 0;
+    char* chars = editorRowText(row, &CS.view);
+    int start = at - 1;
+    while(start > 0 && (unsigned char)chars[start] >= 0x80) start--;
+
+    int prev = start;
+    while(start < at) {
+        prev = start;
+        start = editorRowNextCluster(row, start);
+    }
+    return prev;
+}
+
+// makes room for need bytes of render (the '\0' included) and as many of hl
+void editorRenderReserve(struct rowRender* r, int need) {
+    if(need > r->capacity) {
+        r->render = realloc(r->render, 2 * (size_t)need);     //hl lives in the second half
+        if(r->render == NULL) die("realloc");
+        r->hl = (unsigned char*)r->render + need;
+        r->capacity = need;
+    }
+}
+
+// builds render from chars into r, growing it if it's too small; only writes to r, view and the row's
+// rwidth, so it's safe to run on any thread that has a view of its own for cold rows
+void editorRenderRow(erow* row, struct coldView* view, struct rowRender* r) {
+    char* chars = editorRowText(row, view);
+    int tabs = 0;
+    int i = 0;
+
+    for(i = 0; i < row->size; i++) {
+        if(chars[i] == '\t') {
+            tabs++;
+        }
+    }
+
+    editorRenderReserve(r, row->size + tabs*(HEAT_TAB_STOP - 1) + 1);
+    char* render = r->render;
+
+    //idx counts bytes of render, col counts screen columns, they only differ once there's UTF-8
+    //control characters and malformed UTF-8 are drawn as '?' so they can't mess up the terminal
+    int idx = 0;
+    int col = 0;
+    i = 0;
+    while(i < row->size) {
+        unsigned char c = chars[i];
+        if(c == '\t') {
+            render[idx++] = ' ';
+            col++;
+            while(col % HEAT_TAB_STOP != 0) {
+                render[idx++] = ' ';
+                col++;
+            }
+            i++;
+        }else if(c < 0x80) {
+            render[idx++] = (iscntrl(c)) ? '?' : c;
+            col++;
+            i++;
+        }else {
+            int width;
+            int len = utf8Cluster(&chars[i], row->size - i, &width);
+            int cp;
+            utf8Decode(&chars[i], row->size - i, &cp);
+            if(cp < 0xA0) {
+                render[idx++] = '?';           //malformed or a C1 control character
+            }else {
+                memcpy(&render[idx], &chars[i], len);
+                idx += len;
+            }
+            col += width;
+            i += len;
+        }
+    }
+
+    render[idx] = '\0';
+    r->rsize = idx;
+    row->rwidth = col;
+}
+
+void editorFreeRender(struct rowRender* r) {
+    free(r->render);
+    r->render = NULL;
+    r->hl = NULL;
+    r->rsize = r->capacity = 0;
+}
+
+void editorCopyRender(struct rowRender* to, struct rowRender* from) {
+    editorRenderReserve(to, from->rsize + 1);
+    memcpy(to->render, from->render, from->rsize + 1);
+    memcpy(to->hl, from->hl, from->rsize);
+    to->rsize = from->rsize;
+}
+
+// the row's chars changed: its old render is thrown away and the new one goes straight into the cache,
+// since the row being edited is about to be drawn anyway
+void editorUpdateRow(erow* row) {
+    int was = row->hlstate;
+    editorCacheDrop(row);
+    editorRowRender(row);
+    editorWrapUpdateRow(row);
+    if(row->hlstate != was && row + 1 < &E.row[E.numRows]) editorUpdateSyntax(row + 1);
+}
+
+void editorFreeRow(erow* row) {
+    editorCacheDrop(row);
+    rbRelease(row->chars);
+    if(row->cold) coldRelease(row->cold);
+}
+
+void editorDelRow(int at) {
+    if(at < 0 || at >= E.numRows) return;
+    editorYankDetach(at);
+
+    int was = E.row[at].hlstate;
+    editorFreeRow(&E.row[at]);
+    memmove(&E.row[at], &E.row[at + 1], sizeof(erow) * (E.numRows - at - 1));
+    E.numRows--;
+    editorWrapReplace(at, 1, 0);
+    editorBracketReplace(at, 1, 0);
+    E.dirty++;
+
+    //the row that moved up now starts in a different state if the deleted row changed it
+    int in = at > 0 ? E.row[at - 1].hlstate : HL_STATE_NORMAL;
+    if(at < E.numRows && was != in) editorUpdateSyntax(&E.row[at]);
+}
+
+//reallocates the entire text so it uses more memory (# characters in each row, multiplied by # rows)
+//set the at at the row we're looking at
+void editorInsertRow(int at, char* s, size_t length) {
+    if(at < 0 || at > E.numRows) return;
+    editorYankDetach(-1);           //the realloc can move every row, not just the ones below at
+    E.row = realloc(E.row, sizeof(erow) * (E.numRows + 1));
+    memmove(&E.row[at + 1], &E.row[at], sizeof(erow) * (E.numRows - at));
+
+    //using row[at] because now row is a pointer to an erow, so dereference to see which part of row it is
+    E.row[at].size = length;
+    //malloc just allocates the memory needed, then memcpy copies the line into the erow
+    E.row[at].chars = rbAlloc(length + 1);    
+    memcpy(E.row[at].chars, s, length);
+    E.row[at].chars[length] = '\0';
+
+    E.row[at].rwidth = 0;
+    E.row[at].vlines = 0;
+    E.row[at].cache = -1;
+    E.row[at].cacheGen = 0;
+    E.row[at].cold = NULL;
+    E.row[at].closes = E.row[at].opens = 0;
+    E.row[at].hash = 0;
+    //starts out as what the next row used to see, so highlighting only carries on if it changed
+    E.row[at].hlstate = at > 0 ? E.row[at - 1].hlstate : HL_STATE_NORMAL;
+    E.numRows++;
+    editorWrapReplace(at, 0, 1);
+    editorBracketReplace(at, 0, 1);
+    editorUpdateRow(&E.row[at]);
+
+    E.dirty++;
+}
+
+// inserts a character into erow "row" at a position "at"
 void editorRowInsertChar(erow* row, int at, int c) {
     if(at < 0 || at > row->size) at = row->size;
-    row->chars = realloc(row->chars, row->size + 2);         // add 2 here because need space for a null byte
+    editorRowThaw(row);
+    row->chars = rbRealloc(row->chars, row->size + 2);       // add 2 here because need space for a null byte
     memmove(&row->chars[at + 1], &row->chars[at], row->size - at + 1);
     row->size++;
     row->chars[at] = c;
@@ -470,7 +1910,8 @@ void editorRowInsertChar(erow* row, int at, int c) {
 }
 
 void editorRowAppendString(erow* row, char* s, size_t len) {
-    row->chars = realloc(row->chars, row->size + len + 1);
+    editorRowThaw(row);
+    row->chars = rbRealloc(row->chars, row->size + len + 1);
     memcpy(&row->chars[row->size], s, len);
     row->size += len;
     row->chars[row->size] = '\0';
@@ -478,143 +1919,2288 @@ void editorRowAppendString(erow* row, char* s, size_t len) {
     E.dirty++;
 }
 
-void editorRowDelChar(erow* row, int at) {
+// deletes one character, which is len bytes long with UTF-8
+void editorRowDelChar(erow* row, int at, int len) {
     if(at < 0 || at >= row->size) return;
+    if(at + len > row->size) len = row->size - at;
+    editorRowThaw(row);
 
-    memmove(&row->chars[at], &row->chars[at + 1], row->size - at);
-    row->size--;
+    row->chars = rbRealloc(row->chars, row->size + 1);      // make sure nobody else sees the change
+    memmove(&row->chars[at], &row->chars[at + len], row->size - at - len + 1);
+    row->size -= len;
     editorUpdateRow(row);
     E.dirty++;
 }
 
 
-/*---------------------------------------------------EDITOR OPERATIONS----------------------------------------*/
+/*-------------------------------------------------ROW MEMO----------------------------------------------------*/
 
-// takes a character and inserts into the position of cursor
-void editorInsertChar(int c) {
-    if(E.cursorY == E.numRows) {                 // need to append a new row
-        editorInsertRow(E.numRows, "", 0);
+// how a row renders and highlights only depends on its text, the state it starts in and the syntax, so every
+// row keeps a hash of those from when it was last highlighted; a row that still hashes the same is skipped,
+// its end state, brackets, width and render cache entry are all still right
+// a row that did change is looked up in RM first, which remembers the last few thousand short lines that got
+// highlighted, one per slot picked by their hash: typing a character and deleting it again, or a log full of
+// the same lines, finds the line already there and only copies its render and hl
+
+struct memoEntry {
+    uint64_t key;                   //0 when empty
+    struct editorSyntax* syntax;    //kept with the text and the state, so a collision can't return the wrong line
+    char* text;
+    int size;
+    unsigned char in, out;
+    int rwidth, closes, opens;
+    struct rowRender r;
+};
+
+struct rowMemo {
+    struct memoEntry* entries;      //HEAT_MEMO_SIZE of them, made the first time one is needed
+    unsigned long refreshes;        //rows that had to be brought up to date
+    unsigned long skips, hits;      //how many of those hadn't changed, and how many were found in the memo
+};
+struct rowMemo RM = {NULL, 0, 0, 0};
+
+// a fast 64-bit hash, eight bytes at a time
+uint64_t editorHash(const char* s, int len, uint64_t seed) {
+    uint64_t h = seed ^ UINT64_C(0x243f6a8885a308d3) ^ ((uint64_t)len * UINT64_C(0x9e3779b97f4a7c15));
+    for(int i = 0; i < len; i += 8) {
+        uint64_t w = 0;
+        memcpy(&w, s + i, len - i < 8 ? len - i : 8);
+        w *= UINT64_C(0x87c37b91114253d5);
+        w ^= w >> 31;
+        h = (h ^ w) * UINT64_C(0x4cf5ad432745937f);
     }
+    //so every byte reaches every bit, the slot is picked with the low ones
+    h ^= h >> 33;
+    h *= UINT64_C(0xff51afd7ed558ccd);
+    h ^= h >> 33;
+    h *= UINT64_C(0xc4ceb9fe1a85ec53);
+    h ^= h >> 33;
+    return h;
+}
 
-    editorRowInsertChar(&E.row[E.cursorY], E.cursorX, c);
-    E.cursorX++;
+uint64_t editorRowKey(const char* text, int size, struct editorSyntax* syn, int in) {
+    return editorHash(text, size, (uint64_t)(uintptr_t)syn * 31 + in);
 }
 
-// if on the beginning of line, just insert a new row
-// otherwise, need to move around line so correct part is at the front
-void editorInsertNewline() {
-    if(E.cursorX == 0) {
-        editorInsertRow(E.cursorY, "", 0);
+// the part of a key a row keeps, never 0 since that means the row has none
+uint32_t editorKeyTag(uint64_t key) {
+    return (uint32_t)(key >> 32) | 1;
+}
+
+struct memoEntry* editorMemoFind(uint64_t key, const char* text, int size, int in) {
+    if(RM.entries == NULL) return NULL;
+    struct memoEntry* m = &RM.entries[key & (HEAT_MEMO_SIZE - 1)];
+    if(key == 0 || m->key != key || m->syntax != E.syntax || m->in != in || m->size != size) return NULL;
+    if(size > 0 && memcmp(m->text, text, size)) return NULL;
+    return m;
+}
+
+// remembers a row that was just highlighted, in place of whatever had its slot
+void editorMemoStore(uint64_t key, const char* text, int size, int in, erow* row, struct rowRender* r) {
+    if(size > HEAT_MEMO_LINE) return;
+    if(RM.entries == NULL) {
+        RM.entries = calloc(HEAT_MEMO_SIZE, sizeof(struct memoEntry));
+        if(RM.entries == NULL) die("calloc");
+    }
+    struct memoEntry* m = &RM.entries[key & (HEAT_MEMO_SIZE - 1)];
+    m->text = realloc(m->text, size + 1);
+    if(m->text == NULL) die("realloc");
+    memcpy(m->text, text, size);
+    editorCopyRender(&m->r, r);
+    m->key = key;
+    m->syntax = E.syntax;
+    m->size = size;
+    m->in = in;
+    m->out = row->hlstate;
+    m->rwidth = row->rwidth;
+    m->closes = row->closes;
+    m->opens = row->opens;
+}
+
+// gives a row the end state, width and brackets it was remembered with
+void editorMemoApply(struct memoEntry* m, erow* row) {
+    row->rwidth = m->rwidth;
+    row->hlstate = m->out;
+    if(row->closes != m->closes || row->opens != m->opens) {
+        row->closes = m->closes;
+        row->opens = m->opens;
+        editorBracketFix(row);
+    }
+}
+
+// brings a row of the active buffer up to date for starting in state "in", rendering it into scratch only
+// if it has to, and returns the state it ends in; hlstate is left for the caller, which wants to know if
+// it changed, and unless the row was skipped it loses its render cache entry
+int editorRowRefresh(erow* row, int in, struct rowRender* scratch) {
+    char* text = editorRowText(row, &CS.view);
+    uint64_t key = editorRowKey(text, row->size, E.syntax, in);
+    RM.refreshes++;
+    if(editorKeyTag(key) == row->hash) {
+        RM.skips++;
+        return row->hlstate;
+    }
+    editorCacheDrop(row);
+    row->hash = editorKeyTag(key);
+
+    int was = row->hlstate;
+    struct memoEntry* m = editorMemoFind(key, text, row->size, in);
+    if(m) {
+        RM.hits++;
+        editorMemoApply(m, row);
     }else {
-        erow* row = &E.row[E.cursorY];
-        editorInsertRow(E.cursorY + 1, &row->chars[E.cursorX], row->size - E.cursorX);
-        row = &E.row[E.cursorY];
-        row->size = E.cursorX;
-        row->chars[row->size] = '\0';
-        editorUpdateRow(row);
+        editorRenderRow(row, &CS.view, scratch);
+        row->hlstate = editorHighlightRow(scratch, E.syntax, in);
+        editorBracketUpdate(row, scratch);
+        editorMemoStore(key, text, row->size, in, row, scratch);
     }
+    int out = row->hlstate;
+    row->hlstate = was;
+    return out;
+}
 
-    E.cursorY++;
-    E.cursorX = 0;
+/*-------------------------------------------------RENDER CACHE------------------------------------------------*/
+
+// render and hl are about three times the size of chars, and only the rows on screen ever need them,
+// so they aren't kept for every row; they're built the first time a row is drawn and kept in RC, which
+// holds them in least recently used order and throws the oldest out once they take up more than
+// HEAT_CACHE_MB megabytes (32 by default), however big the file is
+// a row only remembers the slot of its entry and the slot's generation; emptying a slot bumps the
+// generation, so a row whose entry was thrown out just sees a mismatch and builds a new one
+// anything editorRowRender returns is only good until the next call, since that can evict it or move the pool
+
+size_t editorCacheLimit() {
+    if(RC.limit == 0) {
+        char* env = getenv("HEAT_CACHE_MB");
+        long mb = env ? atol(env) : HEAT_CACHE_MB;
+        if(mb < 1) mb = 1;
+        RC.limit = (size_t)mb << 20;
+    }
+    return RC.limit;
 }
 
-void editorDelChar() {
-    if(E.cursorY == E.numRows) return;
-    if(E.cursorX == 0 && E.cursorY == 0) return;
+// what an entry counts against the budget, the bookkeeping included
+size_t editorCacheCost(struct rowRender* r) {
+    return 2 * (size_t)r->capacity + sizeof(struct renderEntry);
+}
 
-    erow* row = &E.row[E.cursorY];
-    if(E.cursorX > 0) {
-        editorRowDelChar(row, E.cursorX - 1);
-        E.cursorX--;
+void editorCacheUnlink(int slot) {
+    struct renderEntry* e = &RC.entries[slot];
+    if(e->prev != -1) RC.entries[e->prev].next = e->next; else RC.head = e->next;
+    if(e->next != -1) RC.entries[e->next].prev = e->prev; else RC.tail = e->prev;
+}
+
+void editorCachePushFront(int slot) {
+    struct renderEntry* e = &RC.entries[slot];
+    e->prev = -1;
+    e->next = RC.head;
+    if(RC.head != -1) RC.entries[RC.head].prev = slot;
+    RC.head = slot;
+    if(RC.tail == -1) RC.tail = slot;
+}
+
+void editorCacheEvict(int slot) {
+    struct renderEntry* e = &RC.entries[slot];
+    editorCacheUnlink(slot);
+    RC.bytes -= editorCacheCost(&e->r);
+    editorFreeRender(&e->r);
+    e->used = 0;
+    e->gen++;
+    e->next = RC.freeSlot;
+    RC.freeSlot = slot;
+}
+
+// throws out a row's entry if it still has one, for when its chars change or the row goes away
+// otherwise the entry would sit in the pool until it aged out, counting against the budget the whole time
+void editorCacheDrop(erow* row) {
+    int slot = row->cache;
+    if(slot >= 0 && slot < RC.capacity && RC.entries[slot].used && RC.entries[slot].gen == row->cacheGen) {
+        editorCacheEvict(slot);
+    }
+    row->cache = -1;
+}
+
+// an empty slot, the pool doubles when there are none left
+int editorCacheAlloc() {
+    if(RC.freeSlot == -1) {
+        int old = RC.capacity;
+        RC.capacity = old ? old * 2 : 256;
+        RC.entries = realloc(RC.entries, sizeof(struct renderEntry) * RC.capacity);
+        if(RC.entries == NULL) die("realloc");
+        for(int i = RC.capacity - 1; i >= old; i--) {
+            memset(&RC.entries[i], 0, sizeof(struct renderEntry));
+            RC.entries[i].next = RC.freeSlot;
+            RC.freeSlot = i;
+        }
+    }
+    int slot = RC.freeSlot;
+    RC.freeSlot = RC.entries[slot].next;
+    RC.entries[slot].used = 1;
+    return slot;
+}
+
+// render and hl for a row of the active buffer, built (and highlighted from the state the row above
+// ended in) if the row has nothing in the cache
+struct rowRender* editorRowRender(erow* row) {
+    int slot = row->cache;
+    if(slot >= 0 && slot < RC.capacity && RC.entries[slot].used && RC.entries[slot].gen == row->cacheGen) {
+        if(RC.head != slot) {
+            editorCacheUnlink(slot);
+            editorCachePushFront(slot);
+        }
+        return &RC.entries[slot].r;
+    }
+
+    slot = editorCacheAlloc();
+    struct renderEntry* e = &RC.entries[slot];
+    int in = row > E.row ? row[-1].hlstate : HL_STATE_NORMAL;
+    char* text = editorRowText(row, &CS.view);
+    uint64_t key = editorRowKey(text, row->size, E.syntax, in);
+    struct memoEntry* m = editorMemoFind(key, text, row->size, in);
+    RM.refreshes++;
+    if(m) {
+        RM.hits++;
+        editorCopyRender(&e->r, &m->r);
+        editorMemoApply(m, row);
     }else {
-        E.cursorX = E.row[E.cursorY - 1].size;
-        editorRowAppendString(&E.row[E.cursorY - 1], row->chars, row->size);
-        editorDelRow(E.cursorY);
-        E.cursorY--;
+        editorRenderRow(row, &CS.view, &e->r);
+        row->hlstate = editorHighlightRow(&e->r, E.syntax, in);
+        editorBracketUpdate(row, &e->r);
+        editorMemoStore(key, text, row->size, in, row, &e->r);
+    }
+    row->hash = editorKeyTag(key);
+    row->cache = slot;
+    row->cacheGen = e->gen;
+    RC.bytes += editorCacheCost(&e->r);
+    editorCachePushFront(slot);
+
+    //the entry that was just made always stays, even if it's bigger than the whole budget
+    size_t limit = editorCacheLimit();
+    while(RC.bytes > limit && RC.tail != slot) {
+        editorCacheEvict(RC.tail);
     }
+    return &RC.entries[slot].r;
 }
 
-/*--------------------------------------------------FILE I/O---------------------------------------------------*/
-void editorOpen(char* filename) {
-    free(E.filename);
-    E.filename = strdup(filename);
 
-    editorSelectSyntaxHighlight();
-    
-    //takes in a file, using getline to add all contents into of file into a char*
-    FILE* fp = fopen(filename, "r");
-    if(!fp) {
-        die("fopen");
+/*-------------------------------------------------PARALLEL HIGHLIGHTING----------------------------------------*/
+
+// opening a big file has to lex every row to find out which state each one ends in, so the rows are cut into chunks and handed to a
+// pool of threads; each thread has its own deque of chunks and takes work from its back, and when it runs
+// out it steals from the front of somebody else's, so no thread sits idle while another has a backlog
+// a chunk can't know what state the chunk before it ends in (an open block comment) until that one is
+// done, so every chunk but the first guesses HL_STATE_NORMAL; afterwards the guesses are checked in order and
+// a chunk that guessed wrong is highlighted again, stopping as soon as its rows agree with the first run
+// every row gets its ROW MEMO hash on the way, so later edits and reloads can tell it hasn't changed
+
+struct highlightChunk {
+    int start, end;                 //rows [start, end)
+    int inState;                    //the state the first row starts in, a guess for every chunk but the first
+    int outState;                   //the state the last row ended in, assuming inState was right
+};
+
+struct workDeque {
+    pthread_mutex_t lock;
+    int* items;
+    int head, tail;                 //items[head, tail) are still waiting
+};
+
+struct highlightJob {
+    erow* rows;
+    struct editorSyntax* syntax;
+    struct highlightChunk* chunks;
+    struct workDeque* deques;
+    int numWorkers;
+};
+
+struct highlightWorker {
+    struct highlightJob* job;
+    int id;
+};
+
+// works out the end states (and widths) of one chunk starting from its inState
+// rows are rendered into the worker's scratch space and dropped, the cache fills in as rows get drawn
+void highlightChunkRun(struct highlightJob* job, struct highlightChunk* chunk, struct coldView* view, struct rowRender* scratch) {
+    int state = chunk->inState;
+    for(int i = chunk->start; i < chunk->end; i++) {
+        erow* row = &job->rows[i];
+        row->hash = editorKeyTag(editorRowKey(editorRowText(row, view), row->size, job->syntax, state));
+        editorRenderRow(row, view, scratch);
+        state = editorHighlightRow(scratch, job->syntax, state);
+        editorRowBrackets(&job->rows[i], scratch);
+        job->rows[i].hlstate = state;
+        job->rows[i].cache = -1;
     }
+    chunk->outState = state;
+}
 
-    char* line = NULL;
-    size_t lineCapacity = 0;
-    ssize_t lineLength;
-    while((lineLength = getline(&line, &lineCapacity, fp)) != -1) {
-        while(lineLength > 0 && (line[lineLength - 1] == '\n' || line[lineLength - 1] == '\r')) {
-            lineLength--;
+// takes the next chunk for worker "id", from its own deque first and then by stealing, -1 when all are done
+int highlightNextChunk(struct highlightJob* job, int id) {
+    for(int k = 0; k < job->numWorkers; k++) {
+        int victim = (id + k) % job->numWorkers;
+        struct workDeque* dq = &job->deques[victim];
+        int chunk = -1;
+
+        pthread_mutex_lock(&dq->lock);
+        if(dq->head < dq->tail) {
+            chunk = (k == 0) ? dq->items[--dq->tail] : dq->items[dq->head++];
         }
+        pthread_mutex_unlock(&dq->lock);
 
-        editorInsertRow(E.numRows, line, lineLength);
+        if(chunk != -1) return chunk;
     }
+    return -1;
+}
 
-    free(line);
-    fclose(fp);
-    E.dirty = 0;
+void* highlightWorkerMain(void* arg) {
+    struct highlightWorker* worker = arg;
+    struct rowRender scratch = {NULL, NULL, 0, 0};
+    struct coldView view = {0, NULL, 0};
+    int chunk;
+    while((chunk = highlightNextChunk(worker->job, worker->id)) != -1) {
+        highlightChunkRun(worker->job, &worker->job->chunks[chunk], &view, &scratch);
+    }
+    editorFreeRender(&scratch);
+    editorFreeView(&view);
+    return NULL;
+}
+
+// one thread per core, unless HEAT_THREADS says otherwise
+int editorNumThreads() {
+    char* env = getenv("HEAT_THREADS");
+    long n = env ? atol(env) : sysconf(_SC_NPROCESSORS_ONLN);
+    if(n < 1) n = 1;
+    if(n > HEAT_MAX_THREADS) n = HEAT_MAX_THREADS;
+    return (int)n;
+}
+
+// highlights rows [from, to) of the active buffer from scratch, in parallel when there are a lot of them,
+// and fixes up both trees over them; the rows after "to" are left for the caller to carry on into
+// whatever the rows had in the render cache is dropped, since the syntax may have changed
+void editorHighlightSpan(int from, int to) {
+    int threads = editorNumThreads();
+    int rows = to - from;
+    int in = from > 0 ? E.row[from - 1].hlstate : HL_STATE_NORMAL;
+    //the workers can't touch the cache, so any entries the rows still have go first
+    for(int i = from; i < to; i++) {
+        editorCacheDrop(&E.row[i]);
+    }
+    if(rows < HEAT_PARALLEL_MIN_ROWS || threads == 1) {
+        struct highlightJob job;
+        struct highlightChunk all = {from, to, in, HL_STATE_NORMAL};
+        struct rowRender scratch = {NULL, NULL, 0, 0};
+        job.rows = E.row;
+        job.syntax = E.syntax;
+        highlightChunkRun(&job, &all, &CS.view, &scratch);
+        editorFreeRender(&scratch);
+        editorWrapReplace(from, rows, rows);
+        editorBracketReplace(from, rows, rows);
+        return;
+    }
+
+    //several chunks per thread, so there's something left to steal near the end
+    int chunkRows = rows / (threads * 8) + 1;
+    int numChunks = (rows + chunkRows - 1) / chunkRows;
+
+    struct highlightJob job;
+    job.rows = E.row;
+    job.syntax = E.syntax;
+    job.numWorkers = threads;
+    job.chunks = malloc(sizeof(struct highlightChunk) * numChunks);
+    job.deques = malloc(sizeof(struct workDeque) * threads);
+    for(int c = 0; c < numChunks; c++) {
+        job.chunks[c].start = from + c * chunkRows;
+        job.chunks[c].end = (c + 1) * chunkRows < rows ? from + (c + 1) * chunkRows : to;
+        job.chunks[c].inState = c == 0 ? in : HL_STATE_NORMAL;
+    }
+
+    //every worker starts with a run of neighbouring chunks
+    for(int w = 0; w < threads; w++) {
+        struct workDeque* dq = &job.deques[w];
+        pthread_mutex_init(&dq->lock, NULL);
+        int first = (long)numChunks * w / threads;
+        int last = (long)numChunks * (w + 1) / threads;
+        dq->items = malloc(sizeof(int) * (last - first + 1));
+        dq->head = dq->tail = 0;
+        for(int c = last - 1; c >= first; c--) {
+            dq->items[dq->tail++] = c;
+        }
+    }
+
+    unicodeBuildBmpTable();
+
+    //the main thread is worker 0
+    pthread_t tids[HEAT_MAX_THREADS];
+    struct highlightWorker workers[HEAT_MAX_THREADS];
+    int started = 1;
+    for(int w = 0; w < threads; w++) {
+        workers[w].job = &job;
+        workers[w].id = w;
+    }
+    sigset_t mask;
+    editorBlockResize(&mask);
+    for(int w = 1; w < threads; w++) {
+        if(pthread_create(&tids[w], NULL, highlightWorkerMain, &workers[w]) != 0) break;
+        started++;
+    }
+    pthread_sigmask(SIG_SETMASK, &mask, NULL);
+    highlightWorkerMain(&workers[0]);
+    for(int w = 1; w < started; w++) {
+        pthread_join(tids[w], NULL);
+    }
+
+    //now fix up the chunks that guessed the wrong starting state
+    struct rowRender scratch = {NULL, NULL, 0, 0};
+    int state = job.chunks[0].outState;
+    for(int c = 1; c < numChunks; c++) {
+        struct highlightChunk* chunk = &job.chunks[c];
+        if(state != chunk->inState) {
+            for(int i = chunk->start; i < chunk->end; i++) {
+                int was = E.row[i].hlstate;
+                char* text = editorRowText(&E.row[i], &CS.view);
+                E.row[i].hash = editorKeyTag(editorRowKey(text, E.row[i].size, E.syntax, state));
+                editorRenderRow(&E.row[i], &CS.view, &scratch);
+                state = editorHighlightRow(&scratch, E.syntax, state);
+                editorRowBrackets(&E.row[i], &scratch);
+                E.row[i].hlstate = state;
+                if(state == was) {
+                    state = chunk->outState;        //the rest of the chunk already saw the right state
+                    break;
+                }
+            }
+        }else {
+            state = chunk->outState;
+        }
+    }
+
+    editorFreeRender(&scratch);
+    for(int w = 0; w < threads; w++) {
+        pthread_mutex_destroy(&job.deques[w].lock);
+        free(job.deques[w].items);
+    }
+    free(job.deques);
+    free(job.chunks);
+    editorWrapReplace(from, rows, rows);
+    editorBracketReplace(from, rows, rows);
+}
+
+// finds the state every row of the active buffer ends in, after a file was loaded or its syntax changed
+void editorHighlightRows() {
+    editorHighlightSpan(0, E.numRows);
+}
+
+/*------------------------------------------------------BRACKETS------------------------------------------------*/
+
+// every row knows how many brackets it closes that were opened above it and how many it leaves open, skipping
+// the ones in strings and comments; they're counted wherever the row gets highlighted, so they're never stale
+// a segment tree over those counts finds the row a bracket's match is on in O(log n), however far away it is;
+// (), [] and {} are counted together, which finds the same match as long as they're nested properly
+
+// +1 for an opening bracket at render byte i, -1 for a closing one, 0 for anything else
+int editorBracketAt(struct rowRender* r, int i) {
+    if(r->hl[i] == HL_STRING || r->hl[i] == HL_COMMENT) return 0;
+    switch(r->render[i]) {
+        case '(': case '[': case '{':
+            return 1;
+        case ')': case ']': case '}':
+            return -1;
+    }
+    return 0;
+}
+
+// counts a freshly highlighted row's brackets, safe to call from the highlighting threads
+// returns whether they changed
+int editorRowBrackets(erow* row, struct rowRender* r) {
+    int closes = 0, opens = 0;
+    for(int i = 0; i < r->rsize; i++) {
+        int b = editorBracketAt(r, i);
+        if(b > 0) {
+            opens++;
+        }else if(b < 0) {
+            if(opens > 0) opens--;
+            else closes++;
+        }
+    }
+    int changed = closes != row->closes || opens != row->opens;
+    row->closes = closes;
+    row->opens = opens;
+    return changed;
+}
+
+struct bracketCount bracketJoin(struct bracketCount a, struct bracketCount b) {
+    int matched = a.opens < b.closes ? a.opens : b.closes;
+    struct bracketCount joined = {a.closes + b.closes - matched, a.opens + b.opens - matched};
+    return joined;
+}
+
+// leaves start at bracketSize, node k covers its children 2k and 2k + 1
+int editorBracketSize(int rows) {
+    int size = 1;
+    while(size < rows) size *= 2;
+    return size;
+}
+
+void editorBracketBuild() {
+    int size = editorBracketSize(E.numRows);
+    free(E.brackettree);
+    E.brackettree = calloc(2 * size, sizeof(struct bracketCount));
+    if(E.brackettree == NULL) die("calloc");
+    for(int i = 0; i < E.numRows; i++) {
+        E.brackettree[size + i].closes = E.row[i].closes;
+        E.brackettree[size + i].opens = E.row[i].opens;
+    }
+    for(int k = size - 1; k > 0; k--) {
+        E.brackettree[k] = bracketJoin(E.brackettree[2 * k], E.brackettree[2 * k + 1]);
+    }
+    E.bracketRows = E.numRows;
+    E.bracketSize = size;
+    E.bracketStale = 0;
+}
+
+void editorBracketEnsure() {
+    if(E.brackettree == NULL || E.bracketStale || E.bracketRows != E.numRows) {
+        editorBracketBuild();
+    }
+}
+
+// recounts a row of the active buffer after it was highlighted, and fixes up the tree
+void editorBracketUpdate(erow* row, struct rowRender* r) {
+    if(editorRowBrackets(row, r)) editorBracketFix(row);
 }
 
-// returns a string of the entire text file
-char* editorRowsToString(int* buflen) {
-    int totalLen = 0;
-    int j;
-    for(j = 0; j < E.numRows; j++) {
-        totalLen += E.row[j].size + 1;
-    }
-    *buflen = totalLen;
+// a row's counts changed, its leaf and the nodes above it follow if the tree is still up to date
+void editorBracketFix(erow* row) {
+    int at = row - E.row;
+    if(E.brackettree == NULL || E.bracketStale || at < 0 || at >= E.bracketRows) return;
+
+    int k = E.bracketSize + at;
+    E.brackettree[k].closes = row->closes;
+    E.brackettree[k].opens = row->opens;
+    for(k /= 2; k > 0; k /= 2) {
+        E.brackettree[k] = bracketJoin(E.brackettree[2 * k], E.brackettree[2 * k + 1]);
+    }
+}
+
+// joins the nodes above leaves lo to hi - 1 again, after those leaves changed
+void editorBracketRejoin(int lo, int hi) {
+    if(lo >= hi) return;
+    lo += E.bracketSize;
+    hi += E.bracketSize - 1;
+    for(lo /= 2, hi /= 2; lo > 0; lo /= 2, hi /= 2) {
+        for(int k = lo; k <= hi; k++) {
+            E.brackettree[k] = bracketJoin(E.brackettree[2 * k], E.brackettree[2 * k + 1]);
+        }
+    }
+}
+
+// the n rows at "at" were replaced by the m rows that are there now, inserting is n = 0 and deleting is m = 0:
+// the leaves after them move along and the new rows' counts go in, so the tree never has to be built again
+// while there's room; only the nodes above the leaves that changed or moved are joined again
+void editorBracketReplace(int at, int n, int m) {
+    if(E.brackettree == NULL || E.bracketStale || at + n > E.bracketRows) return;
+    int old = E.bracketRows, rows = old - n + m;
+    if(rows > E.bracketSize) {
+        E.bracketStale = 1;         //out of leaves, the next lookup builds a tree twice the size
+        return;
+    }
+    struct bracketCount* leaf = &E.brackettree[E.bracketSize];
+    memmove(&leaf[at + m], &leaf[at + n], sizeof(struct bracketCount) * (old - at - n));
+    for(int i = at; i < at + m; i++) {
+        leaf[i].closes = E.row[i].closes;
+        leaf[i].opens = E.row[i].opens;
+    }
+    if(rows < old) memset(&leaf[rows], 0, sizeof(struct bracketCount) * (old - rows));
+    E.bracketRows = rows;
+    editorBracketRejoin(at, n == m ? at + m : rows > old ? rows : old);
+}
+
+// first row at or after "from" where everything acc leaves open is closed, acc is updated up to that row
+int bracketFindForward(int node, int lo, int hi, int from, struct bracketCount* acc) {
+    if(hi <= from) return -1;
+    if(lo >= from) {
+        if(E.brackettree[node].closes < acc->opens) {
+            *acc = bracketJoin(*acc, E.brackettree[node]);
+            return -1;
+        }
+        if(hi - lo == 1) return lo;
+    }
+    int mid = lo + (hi - lo) / 2;
+    int found = bracketFindForward(2 * node, lo, mid, from, acc);
+    if(found >= 0) return found;
+    return bracketFindForward(2 * node + 1, mid, hi, from, acc);
+}
+
+// last row at or before "from" where everything acc closes is opened, acc is updated back to that row
+int bracketFindBackward(int node, int lo, int hi, int from, struct bracketCount* acc) {
+    if(lo > from) return -1;
+    if(hi - 1 <= from) {
+        if(E.brackettree[node].opens < acc->closes) {
+            *acc = bracketJoin(E.brackettree[node], *acc);
+            return -1;
+        }
+        if(hi - lo == 1) return lo;
+    }
+    int mid = lo + (hi - lo) / 2;
+    int found = bracketFindBackward(2 * node + 1, mid, hi, from, acc);
+    if(found >= 0) return found;
+    return bracketFindBackward(2 * node, lo, mid, from, acc);
+}
+
+// finds the bracket matching the one at render byte "at" of row y, returns 0 if it isn't a bracket or has no match
+int editorMatchBracket(int y, int at, int* matchY, int* matchAt) {
+    struct rowRender* r = editorRowRender(&E.row[y]);
+    if(at >= r->rsize) return 0;
+    int dir = editorBracketAt(r, at);
+    if(dir == 0) return 0;
+
+    //the rest of its own row first
+    int depth = 1;
+    for(int i = at + dir; i >= 0 && i < r->rsize; i += dir) {
+        depth += dir * editorBracketAt(r, i);
+        if(depth == 0) {
+            *matchY = y;
+            *matchAt = i;
+            return 1;
+        }
+    }
+
+    //then the tree finds the row where the depth runs out, and that row is walked to find the bracket
+    editorBracketEnsure();
+    int size = E.bracketSize;
+    int row;
+    if(dir > 0) {
+        struct bracketCount acc = {0, depth};
+        row = bracketFindForward(1, 0, size, y + 1, &acc);
+        depth = acc.opens;
+    }else {
+        struct bracketCount acc = {depth, 0};
+        row = y > 0 ? bracketFindBackward(1, 0, size, y - 1, &acc) : -1;
+        depth = acc.closes;
+    }
+    if(row < 0 || row >= E.numRows) return 0;
+
+    r = editorRowRender(&E.row[row]);
+    for(int i = dir > 0 ? 0 : r->rsize - 1; i >= 0 && i < r->rsize; i += dir) {
+        depth += dir * editorBracketAt(r, i);
+        if(depth == 0) {
+            *matchY = row;
+            *matchAt = i;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// the match for the bracket under the cursor
+int editorCursorBracket(int* matchY, int* matchAt) {
+    if(E.cursorY >= E.numRows) return 0;
+    erow* row = &E.row[E.cursorY];
+    int rx = editorRowCursorXToRx(row, E.cursorX);
+    int at = editorRenderColumn(row, editorRowRender(row), rx);
+    return editorMatchBracket(E.cursorY, at, matchY, matchAt);
+}
+
+// done once per frame by editorRefreshScreen, so the match can be drawn without looking for it on every row
+void editorFindCursorMatch() {
+    M.rows = editorCursorBracket(&M.y, &M.at) ? E.row : NULL;
+}
+
+// Ctrl-], puts the cursor on the matching bracket
+void editorJumpBracket() {
+    int y, at;
+    if(!editorCursorBracket(&y, &at)) {
+        editorSetStatusMessage("No matching bracket");
+        return;
+    }
+    erow* row = &E.row[y];
+    struct rowRender* r = editorRowRender(row);
+    //the column the bracket is drawn in, then the chars index for it
+    int col = at;
+    if(row->rwidth != r->rsize) {
+        int i = 0, width;
+        col = 0;
+        while(i < at) {
+            i += utf8Cluster(&r->render[i], r->rsize - i, &width);
+            col += width;
+        }
+    }
+    E.cursorY = y;
+    E.cursorX = editorRowRxToCx(row, col);
+}
+
+/*---------------------------------------------------EDITOR OPERATIONS----------------------------------------*/
+
+// takes a character and inserts into the position of cursor
+void editorInsertChar(int c) {
+    if(E.cursorY == E.numRows) {                 // need to append a new row
+        editorInsertRow(E.numRows, "", 0);
+    }
+
+    editorRowInsertChar(&E.row[E.cursorY], E.cursorX, c);
+    E.cursorX++;
+}
+
+// if on the beginning of line, just insert a new row
+// otherwise, need to move around line so correct part is at the front
+void editorInsertNewline() {
+    if(E.cursorX == 0) {
+        editorInsertRow(E.cursorY, "", 0);
+    }else {
+        erow* row = &E.row[E.cursorY];
+        editorRowThaw(row);
+        editorInsertRow(E.cursorY + 1, &row->chars[E.cursorX], row->size - E.cursorX);
+        row = &E.row[E.cursorY];
+        row->size = E.cursorX;
+        row->chars = rbRealloc(row->chars, row->size + 1);
+        row->chars[row->size] = '\0';
+        editorUpdateRow(row);
+    }
+
+    E.cursorY++;
+    E.cursorX = 0;
+}
+
+void editorDelChar() {
+    if(E.cursorY == E.numRows) return;
+    if(E.cursorX == 0 && E.cursorY == 0) return;
+
+    erow* row = &E.row[E.cursorY];
+    if(E.cursorX > 0) {
+        int prev = editorRowPrevCluster(row, E.cursorX);
+        editorRowDelChar(row, prev, E.cursorX - prev);
+        E.cursorX = prev;
+    }else {
+        E.cursorX = E.row[E.cursorY - 1].size;
+        editorRowThaw(row);
+        editorRowAppendString(&E.row[E.cursorY - 1], row->chars, row->size);
+        editorDelRow(E.cursorY);
+        E.cursorY--;
+    }
+}
+
+/*-------------------------------------------------MULTIPLE CURSORS---------------------------------------------*/
+
+// besides the cursor at cursorX/cursorY there can be any number of extra ones (Ctrl-A adds one on the next
+// line), or a rectangular block being selected (Ctrl-Q, then move to the other corner and type)
+// an edit goes to every cursor as one batch: all the chars are changed first, then every row that was touched
+// is rendered and highlighted once, in order, so a keystroke costs one pass over the rows it changed
+
+int editorCursorCompare(const void* a, const void* b) {
+    const struct cursor* p = a;
+    const struct cursor* q = b;
+    if(p->y != q->y) return p->y < q->y ? -1 : 1;
+    return (p->x > q->x) - (p->x < q->x);
+}
+
+// first extra cursor on row y or after it
+int editorCursorFind(int y) {
+    int lo = 0, hi = E.numCursors;
+    while(lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if(E.cursors[mid].y < y) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+void editorClearCursors() {
+    free(E.cursors);
+    E.cursors = NULL;
+    E.numCursors = 0;
+    E.block = 0;
+}
+
+// the block's rows and screen columns, [left, right) with the right one left out like a cursor is
+void editorBlockRange(int* top, int* bottom, int* left, int* right) {
+    int x = E.blockY < E.numRows ? editorRowCursorXToRx(&E.row[E.blockY], E.blockX) : 0;
+    int cx = E.cursorY < E.numRows ? editorRowCursorXToRx(&E.row[E.cursorY], E.cursorX) : 0;
+    *top = E.blockY < E.cursorY ? E.blockY : E.cursorY;
+    *bottom = E.blockY < E.cursorY ? E.cursorY : E.blockY;
+    *left = x < cx ? x : cx;
+    *right = x < cx ? cx : x;
+}
+
+// replaces del bytes at "at" with s, without updating anything else about the row, see editorUpdateRows
+void editorRowSplice(erow* row, int at, int del, const char* s, int len) {
+    editorRowThaw(row);
+    int size = row->size - del + len;
+    row->chars = rbRealloc(row->chars, (size > row->size ? size : row->size) + 1);
+    memmove(&row->chars[at + len], &row->chars[at + del], row->size - at - del + 1);
+    if(len > 0) memcpy(&row->chars[at], s, len);
+    row->size = size;
+    E.dirty++;
+}
+
+// brings the rows a batch touched up to date, each once and in order; a row whose end state changed
+// carries on into the rows below like editorUpdateSyntax, and touched rows it already passed are skipped
+void editorUpdateRows(int* rows, int n) {
+    struct rowRender scratch = {NULL, NULL, 0, 0};
+    int done = -1;
+    for(int k = 0; k < n; k++) {
+        for(int i = rows[k]; i > done && i < E.numRows; i++) {
+            erow* row = &E.row[i];
+            int in = i > 0 ? row[-1].hlstate : HL_STATE_NORMAL;
+            int out = editorRowRefresh(row, in, &scratch);
+            editorWrapUpdateRow(row);
+            int changed = row->hlstate != out;
+            row->hlstate = out;
+            done = i;
+            if(!changed) break;
+        }
+    }
+    editorFreeRender(&scratch);
+}
+
+// every cursor in one sorted array, "primary" is where cursorX/cursorY ended up in it
+struct cursor* editorAllCursors(int* n, int* primary) {
+    struct cursor* all = malloc(sizeof(struct cursor) * (E.numCursors + 1));
+    struct cursor p = {E.cursorX, E.cursorY};
+    int at = 0;
+    while(at < E.numCursors && editorCursorCompare(&E.cursors[at], &p) < 0) at++;
+    all[at] = p;
+    if(E.numCursors > 0) {
+        memcpy(all, E.cursors, sizeof(struct cursor) * at);
+        memcpy(&all[at + 1], &E.cursors[at], sizeof(struct cursor) * (E.numCursors - at));
+    }
+    *n = E.numCursors + 1;
+    *primary = at;
+    return all;
+}
+
+// takes "all" back, sorted, as the cursors; ones that ran into each other become one
+void editorSetCursors(struct cursor* all, int n, int primary) {
+    E.cursorX = all[primary].x;
+    E.cursorY = all[primary].y;
+    int m = 0;
+    for(int i = 0; i < n; i++) {
+        if(i == primary || (all[i].x == E.cursorX && all[i].y == E.cursorY)) continue;
+        if(m > 0 && all[i].x == all[m - 1].x && all[i].y == all[m - 1].y) continue;
+        all[m++] = all[i];
+    }
+    free(E.cursors);
+    E.cursors = all;
+    E.numCursors = m;
+}
+
+// Ctrl-A, leaves a cursor where this one is and moves down a line
+void editorAddCursorBelow() {
+    if(E.cursorY + 1 >= E.numRows) return;
+    E.block = 0;
+    E.cursors = realloc(E.cursors, sizeof(struct cursor) * (E.numCursors + 1));
+    E.cursors[E.numCursors].x = E.cursorX;
+    E.cursors[E.numCursors].y = E.cursorY;
+    E.numCursors++;
+    //they are usually added going down, so only sort if this one came out of order
+    if(E.numCursors > 1 && editorCursorCompare(&E.cursors[E.numCursors - 2], &E.cursors[E.numCursors - 1]) > 0) {
+        qsort(E.cursors, E.numCursors, sizeof(struct cursor), editorCursorCompare);
+    }
+    editorMoveCursor(ARROW_DOWN);
+
+    int n, primary;
+    struct cursor* all = editorAllCursors(&n, &primary);
+    editorSetCursors(all, n, primary);
+    editorSetStatusMessage("%d cursors (Esc for one)", E.numCursors + 1);
+}
+
+// Ctrl-Q, starts a block at the cursor or drops it
+void editorToggleBlock() {
+    if(E.block || E.numRows == 0) {
+        E.block = 0;
+        return;
+    }
+    editorClearCursors();
+    E.block = 1;
+    E.blockX = E.cursorX;
+    E.blockY = E.cursorY;
+    editorSetStatusMessage("Block: move to the other corner and type (Esc cancels)");
+}
+
+// an edit on a block deletes what's in it and puts a cursor on each of its rows where it started
+// returns whether there was anything to delete
+int editorCursorsFromBlock() {
+    if(!E.block) return 0;
+    int top, bottom, left, right;
+    editorBlockRange(&top, &bottom, &left, &right);
+    E.block = 0;
+    if(bottom >= E.numRows) bottom = E.numRows - 1;
+    if(top > bottom) return 0;
+
+    int n = bottom - top + 1, touched = 0;
+    struct cursor* all = malloc(sizeof(struct cursor) * n);
+    int* rows = malloc(sizeof(int) * n);
+    for(int y = top; y <= bottom; y++) {
+        erow* row = &E.row[y];
+        int from = editorRowRxToCx(row, left);
+        int to = editorRowRxToCx(row, right);
+        if(to > from) {
+            editorRowSplice(row, from, to - from, NULL, 0);
+            rows[touched++] = y;
+        }
+        all[y - top].x = from;
+        all[y - top].y = y;
+    }
+    editorUpdateRows(rows, touched);
+    free(rows);
+
+    int primary = E.cursorY - top;
+    if(primary >= n) primary = n - 1;
+    free(E.cursors);
+    E.cursors = NULL;
+    E.numCursors = 0;
+    editorSetCursors(all, n, primary);
+    return touched > 0;
+}
+
+// types s at every cursor
+void editorMultiInsert(const char* s, int len) {
+    editorCursorsFromBlock();
+    int n, primary;
+    struct cursor* all = editorAllCursors(&n, &primary);
+    int* rows = malloc(sizeof(int) * n);
+    int touched = 0, offset = 0;
+
+    //cursors further along a row move over by what went in before them
+    for(int i = 0; i < n; i++) {
+        struct cursor* c = &all[i];
+        if(i == 0 || c->y != all[i - 1].y) offset = 0;
+        if(c->y >= E.numRows) continue;
+        c->x += offset;
+        editorRowSplice(&E.row[c->y], c->x, 0, s, len);
+        c->x += len;
+        offset += len;
+        if(touched == 0 || rows[touched - 1] != c->y) rows[touched++] = c->y;
+    }
+    editorUpdateRows(rows, touched);
+    free(rows);
+    editorSetCursors(all, n, primary);
+}
+
+// backspace at every cursor, ones at the start of a line stay where they are
+void editorMultiDelete() {
+    if(editorCursorsFromBlock()) return;        //deleting the block was the backspace
+
+    int n, primary;
+    struct cursor* all = editorAllCursors(&n, &primary);
+    int* rows = malloc(sizeof(int) * n);
+    int touched = 0, offset = 0;
+
+    for(int i = 0; i < n; i++) {
+        struct cursor* c = &all[i];
+        if(i == 0 || c->y != all[i - 1].y) offset = 0;
+        if(c->y >= E.numRows) continue;
+        c->x += offset;
+        if(c->x == 0) continue;
+        erow* row = &E.row[c->y];
+        int prev = editorRowPrevCluster(row, c->x);
+        editorRowSplice(row, prev, c->x - prev, NULL, 0);
+        offset -= c->x - prev;
+        c->x = prev;
+        if(touched == 0 || rows[touched - 1] != c->y) rows[touched++] = c->y;
+    }
+    editorUpdateRows(rows, touched);
+    free(rows);
+    editorSetCursors(all, n, primary);
+}
+
+// moves every cursor the same way
+void editorMultiMove(int key) {
+    int n, primary;
+    struct cursor* all = editorAllCursors(&n, &primary);
+    int x = E.cursorX, y = E.cursorY;
+    for(int i = 0; i < n; i++) {
+        E.cursorX = all[i].x;
+        E.cursorY = all[i].y;
+        if(key == HOME_KEY) {
+            E.cursorX = 0;
+        }else if(key == END_KEY) {
+            if(E.cursorY < E.numRows) E.cursorX = E.row[E.cursorY].size;
+        }else {
+            editorMoveCursor(key);
+        }
+        all[i].x = E.cursorX;
+        all[i].y = E.cursorY;
+        if(i == primary) {
+            x = E.cursorX;
+            y = E.cursorY;
+        }
+    }
+
+    //wrapping around a line end can put them out of order, then find the primary again after sorting
+    qsort(all, n, sizeof(struct cursor), editorCursorCompare);
+    struct cursor p = {x, y};
+    struct cursor* found = bsearch(&p, all, n, sizeof(struct cursor), editorCursorCompare);
+    editorSetCursors(all, n, found - all);
+}
+
+// handles a key while there are extra cursors or a block, returns 0 to let it through to the normal handling
+int editorMultiKey(int c) {
+    switch(c) {
+        case '\r': case DEL_KEY: case PAGE_UP: case PAGE_DOWN:
+        case CTRL_KEY('u'): case CTRL_KEY('d'): case CTRL_KEY('g'):
+        case CTRL_KEY('k'): case CTRL_KEY('c'): case CTRL_KEY('x'): case CTRL_KEY('v'): case CTRL_KEY('r'):
+            editorClearCursors();
+            return 0;
+        case CTRL_KEY('z'): case CTRL_KEY('s'): case CTRL_KEY('o'): case CTRL_KEY('b'):
+        case CTRL_KEY('w'): case CTRL_KEY('e'): case CTRL_KEY('n'): case CTRL_KEY('l'):
+        case CTRL_KEY('a'): case CTRL_KEY('q'): case CTRL_KEY(']'):
+            return 0;
+        case '\x1b':
+            editorClearCursors();
+            return 1;
+        case ARROW_LEFT: case ARROW_RIGHT: case ARROW_UP: case ARROW_DOWN:
+        case HOME_KEY: case END_KEY:
+            if(E.block) return 0;       //moves the corner
+            editorMultiMove(c);
+            return 1;
+        case BACKSPACE: case CTRL_KEY('h'):
+            editorMultiDelete();
+            return 1;
+    }
+
+    //the rest of a UTF-8 character is already waiting, it all goes in at once
+    char s[4];
+    int len = 1;
+    s[0] = c;
+    if(c >= 0xC2 && c <= 0xF4) {
+        int more = c >= 0xF0 ? 3 : c >= 0xE0 ? 2 : 1;
+        while(more--) {
+            s[len++] = editorReadKey();
+        }
+    }
+    editorMultiInsert(s, len);
+    return 1;
+}
+
+// start of the render cluster that covers screen column col, or rsize past the end
+int editorRenderColumn(erow* row, struct rowRender* r, int col) {
+    if(row->rwidth == r->rsize) return col < r->rsize ? col : r->rsize;
+    int i = 0, at = 0, width;
+    while(i < r->rsize) {
+        int len = utf8Cluster(&r->render[i], r->rsize - i, &width);
+        if(at + width > col) break;
+        at += width;
+        i += len;
+    }
+    return i;
+}
+
+// marks the cluster at screen column rx like a cursor
+void editorMarkColumn(erow* row, struct rowRender* r, unsigned char* marked, int rx, int* tail) {
+    int at = editorRenderColumn(row, r, rx);
+    if(at >= r->rsize) {
+        if(rx == row->rwidth) *tail = 1;
+        return;
+    }
+    int width, len = utf8Cluster(&r->render[at], r->rsize - at, &width);
+    for(int i = at; i < at + len; i++) marked[i] |= HL_SELECTED;
+}
+
+// a copy of the row's hl with HL_SELECTED on marked lines, the block and under the extra cursors and HL_MATCH on the
+// matching bracket, or just hl if none of them are on the row
+// "tail" is set when a cursor is past the last character, where there is nothing to mark
+unsigned char* editorMarkRow(erow* row, struct rowRender* r, int* tail) {
+    static unsigned char* marked = NULL;
+    static int capacity = 0;
+    int y = row - E.row;
+    int top = 0, bottom = -1, left = 0, right = 0;
+    if(E.block) editorBlockRange(&top, &bottom, &left, &right);
+    int first = editorCursorFind(y);
+    int inBlock = y >= top && y <= bottom;
+    int markTop = E.markY < E.cursorY ? E.markY : E.cursorY;
+    int markBottom = E.markY < E.cursorY ? E.cursorY : E.markY;
+    int inMark = E.mark && y >= markTop && y <= markBottom;
+    int isMatch = M.rows == E.row && M.y == y && M.at < r->rsize;
+    if(!inBlock && !inMark && !isMatch && (first == E.numCursors || E.cursors[first].y != y)) return r->hl;
+
+    if(r->rsize >= capacity) {
+        capacity = r->rsize * 2 + 1;
+        marked = realloc(marked, capacity);
+    }
+    memcpy(marked, r->hl, r->rsize);
+
+    if(inMark) {
+        for(int i = 0; i < r->rsize; i++) marked[i] |= HL_SELECTED;
+    }
+    if(isMatch) marked[M.at] |= HL_MATCH;
+    if(inBlock && right > left) {
+        int to = editorRenderColumn(row, r, right);
+        for(int i = editorRenderColumn(row, r, left); i < to; i++) marked[i] |= HL_SELECTED;
+    }
+
+    for(int k = first; k < E.numCursors && E.cursors[k].y == y; k++) {
+        editorMarkColumn(row, r, marked, editorRowCursorXToRx(row, E.cursors[k].x), tail);
+    }
+    //a block with no width yet shows where it is like a cursor would
+    if(inBlock && right == left) editorMarkColumn(row, r, marked, left, tail);
+    return marked;
+}
+
+/*--------------------------------------------------FILE I/O---------------------------------------------------*/
+
+// looks for another buffer that already holds this exact file without unsaved changes,
+// so its rows can be shared instead of reading and highlighting everything again
+struct editorBuffer* editorFindSharedBuffer(char* filename) {
+    struct stat want, have;
+    if(stat(filename, &want) == -1) return NULL;
+
+    for(int i = 0; i < E.numBuffers; i++) {
+        struct editorBuffer* b = &E.buffers[i];
+        if(i == E.curBuffer || b->filename == NULL || b->dirty || b->diskChanged || b->hex) continue;
+        if(stat(b->filename, &have) == -1) continue;
+        if(have.st_dev == want.st_dev && have.st_ino == want.st_ino) return b;
+    }
+    return NULL;
+}
+
+// returns -1 if the file can't be opened, the buffer is left empty in that case
+int editorOpen(char* filename) {
+    struct editorBuffer* shared = editorFindSharedBuffer(filename);
+
+    editorUnwatchFile();
+    E.diskChanged = 0;
+    free(E.filename);
+    E.filename = strdup(filename);
+
+    if(shared) {
+        // every row just takes another reference, the first edit to a row gives it its own copy
+        E.row = malloc(sizeof(erow) * shared->numRows);
+        memcpy(E.row, shared->row, sizeof(erow) * shared->numRows);
+        for(int i = 0; i < shared->numRows; i++) {
+            rbRetain(E.row[i].chars);
+            if(E.row[i].cold) E.row[i].cold->refs++;
+        }
+        E.numRows = shared->numRows;
+        E.syntax = shared->syntax;
+        E.dirty = 0;
+        editorWatchFile();
+        return 0;
+    }
+    if(editorIsBinary(filename)) return editorHexOpen();
+
+    E.syntax = editorFindSyntax(E.filename);
+    
+    //takes in a file, using getline to add all contents into of file into a char*
+    FILE* fp = fopen(filename, "r");
+    if(!fp) {
+        return -1;
+    }
+
+    //rows are only read in here, the array doubles as it grows instead of growing by one row each time,
+    //and the states are all worked out afterwards in one go (in parallel for big files)
+    char* line = NULL;
+    size_t lineCapacity = 0;
+    ssize_t lineLength;
+    int capacity = E.numRows;
+    while((lineLength = getline(&line, &lineCapacity, fp)) != -1) {
+        while(lineLength > 0 && (line[lineLength - 1] == '\n' || line[lineLength - 1] == '\r')) {
+            lineLength--;
+        }
+
+        if(E.numRows == capacity) {
+            capacity = capacity ? capacity * 2 : 1024;
+            E.row = realloc(E.row, sizeof(erow) * capacity);
+            if(E.row == NULL) die("realloc");
+        }
+        erow* row = &E.row[E.numRows++];
+        memset(row, 0, sizeof(erow));
+        row->cache = -1;
+        row->size = lineLength;
+        row->chars = rbAlloc(lineLength + 1);
+        memcpy(row->chars, line, lineLength);
+        row->chars[lineLength] = '\0';
+
+        //a big file gets packed as it comes in instead of all being held unpacked first
+        if(E.numRows > HEAT_COLD_MIN_ROWS && E.numRows % HEAT_COLD_ROWS == 0) {
+            editorColdFreeze(E.numRows - HEAT_COLD_ROWS, E.numRows);
+        }
+    }
+
+    free(line);
+    fclose(fp);
+
+    editorHighlightRows();
+    E.wrapStale = 1;
+    E.bracketStale = 1;
+    E.dirty = 0;
+    editorWatchFile();
+    return 0;
+}
+
+// writes every row to fd through a small buffer instead of building the whole file in memory first,
+// cold rows are unpacked a block at a time on the way; returns how many bytes went out, or -1
+long long editorWriteRows(int fd) {
+    char buf[65536];
+    int used = 0;
+    long long total = 0;
+    for(int j = 0; j < E.numRows; j++) {
+        char* text = editorRowText(&E.row[j], &CS.view);
+        int left = E.row[j].size + 1;
+        while(left > 0) {
+            int n = left < (int)sizeof(buf) - used ? left : (int)sizeof(buf) - used;
+            //the last byte of a row is its nul, which goes out as the newline
+            memcpy(&buf[used], text, n);
+            if(n == left) buf[used + n - 1] = '\n';
+            used += n;
+            text += n;
+            left -= n;
+            if(used == sizeof(buf)) {
+                if(write(fd, buf, used) != used) return -1;
+                total += used;
+                used = 0;
+            }
+        }
+    }
+    if(used > 0 && write(fd, buf, used) != used) return -1;
+    return total + used;
+}
+
+// saves the active buffer to disk
+void editorSave() {
+    if(E.filename == NULL) {
+        E.filename = editorPrompt("Save as: %s (ESC to cancel)");
+        if(E.filename == NULL) {
+            editorSetStatusMessage("Save aborted");
+            return;
+        }
+        editorSelectSyntaxHighlight();
+    }
+    if(E.diskChanged == 1) {
+        E.diskChanged = 2;
+        editorSetStatusMessage("%.30s changed on disk, Ctrl-S again overwrites it (Ctrl-R reloads)", E.filename);
+        return;
+    }
+    if(E.hex) {
+        editorHexSave();
+        return;
+    }
+
+    off_t len = 0;
+    for(int j = 0; j < E.numRows; j++) {
+        len += E.row[j].size + 1;
+    }
+    int fd = open(E.filename, O_RDWR | O_CREAT, 0644);      // using the fcntl.h library
+
+    if(fd != -1) {
+        if(ftruncate(fd, len) != -1) {
+            if(editorWriteRows(fd) == len) {
+                close(fd);
+                E.dirty = 0;
+                //what we just wrote shows up as changes too
+                editorCheckDisk(E.watch > 0 ? E.watch : -1);
+                E.diskChanged = 0;
+                editorWatchFile();
+                editorSetStatusMessage("%lld bytes written to disk", (long long)len);
+                return;
+            }
+       }
+       close(fd);
+    }
+
+    editorSetStatusMessage("Can't save, I/O error: %s", strerror(errno));
+}
+
+/*---------------------------------------------------DISK CHANGES-----------------------------------------------*/
+
+// every open file is watched with inotify, so heat notices when something else writes to it; the status bar
+// says so, saving asks before overwriting, and Ctrl-R reloads it
+// a reload only touches what changed: rows that match at the start and end of the file are skipped, and the
+// lines left in between are diffed (Myers, or patience first when that's too many edits); lines are compared
+// by the ROW MEMO hash a row already has, so unchanged packed rows are never unpacked and the file is only
+// read once. rows that are still there keep their erow, with its render cache entry, end state and packed
+// block, both trees move their leaves in place, and only the new lines get highlighted
+
+void editorWatchFile() {
+    if(E.inotifyFd == -1 || E.filename == NULL || E.watch > 0) return;
+    int wd = inotify_add_watch(E.inotifyFd, E.filename, IN_MODIFY | IN_MOVE_SELF | IN_DELETE_SELF);
+    E.watch = wd > 0 ? wd : 0;
+}
+
+// stops watching the active buffer's file, unless another buffer has it open too
+void editorUnwatchFile() {
+    if(E.watch <= 0) return;
+    for(int i = 0; i < E.numBuffers; i++) {
+        if(i != E.curBuffer && E.buffers[i].watch == E.watch) {
+            E.watch = 0;
+            return;
+        }
+    }
+    inotify_rm_watch(E.inotifyFd, E.watch);
+    E.watch = 0;
+}
+
+// marks the buffers watching wd as changed on disk, returns whether the active one is
+// "own" is set when the active buffer made the change itself, the other buffers on that file still need to know
+int editorDiskEvent(int wd, unsigned int mask, int own) {
+    int gone = mask & (IN_MOVE_SELF | IN_DELETE_SELF | IN_IGNORED);
+    if(gone && !(mask & IN_IGNORED)) inotify_rm_watch(E.inotifyFd, wd);
+
+    //the file was moved or deleted, the watch is dropped and made again for whatever is there on reload
+    int active = 0;
+    for(int i = 0; i < E.numBuffers; i++) {
+        struct editorBuffer* b = &E.buffers[i];
+        int* watch = i == E.curBuffer ? &E.watch : &b->watch;
+        int* changed = i == E.curBuffer ? &E.diskChanged : &b->diskChanged;
+        if(*watch != wd || (own && i == E.curBuffer)) continue;
+        if(*changed == 0) *changed = 1;
+        if(gone) *watch = 0;
+        if(i == E.curBuffer) active = 1;
+    }
+    return active;
+}
+
+// reads whatever inotify has queued, events for the watch "ignore" are the active buffer's own writes
+// (every buffer on the same file shares one watch, so only the active one skips them)
+void editorCheckDisk(int ignore) {
+    if(E.inotifyFd == -1) return;
+    int buf[1024];          //ints so the events in it are aligned
+    ssize_t len;
+    int active = 0;
+    while((len = read(E.inotifyFd, buf, sizeof(buf))) > 0) {
+        char* p = (char*)buf;
+        while(p < (char*)buf + len) {
+            struct inotify_event* ev = (struct inotify_event*)p;
+            p += sizeof(struct inotify_event) + ev->len;
+            int own = ev->wd == ignore && !(ev->mask & (IN_MOVE_SELF | IN_DELETE_SELF | IN_IGNORED));
+            active |= editorDiskEvent(ev->wd, ev->mask, own);
+        }
+    }
+    if(active && ignore == 0) {
+        editorSetStatusMessage("%.30s changed on disk, Ctrl-R reloads it", E.filename);
+        editorRefreshScreen();
+    }
+}
+
+// the state old row "at" starts in, which is what its ROW MEMO hash was made with
+int editorRowIn(int at) {
+    return at > 0 ? E.row[at - 1].hlstate : HL_STATE_NORMAL;
+}
+
+// whether an old row still holds this line; a row that was highlighted kept a hash of its text, so hashing
+// the line the same way settles it without unpacking the row (a hash made before its state changed only
+// makes an unchanged row look new, which costs a highlight); rows without one are compared byte by byte
+int editorLineSame(erow* row, const char* text, int len) {
+    if(row->size != len) return 0;
+    if(row->hash == 0) return memcmp(editorRowText(row, &CS.view), text, len) == 0;
+    return editorKeyTag(editorRowKey(text, len, E.syntax, editorRowIn(row - E.row))) == row->hash;
+}
+
+// the new file's lines that didn't match at either end, and the old rows across from them
+struct diffInput {
+    erow* rows;                     //old rows
+    const char** text;              //new lines, with their lengths
+    int* length;
+    uint32_t* tag;                  //the hash of new line j as if it started in state tagIn[j], which is -1 until needed
+    int* tagIn;
+    int n, m;
+};
+
+// editorLineSame, but the new line's hash is kept for the next row that starts in the same state
+int diffEqual(struct diffInput* in, int i, int j) {
+    erow* row = &in->rows[i];
+    if(row->size != in->length[j]) return 0;
+    if(row->hash == 0) return memcmp(editorRowText(row, &CS.view), in->text[j], in->length[j]) == 0;
+    int state = editorRowIn(row - E.row);
+    if(in->tagIn[j] != state) {
+        in->tag[j] = editorKeyTag(editorRowKey(in->text[j], in->length[j], E.syntax, state));
+        in->tagIn[j] = state;
+    }
+    return in->tag[j] == row->hash;
+}
+
+// Myers' greedy diff, fills match[j] with the old row that new line j is, or -1 if it's new
+// the furthest x on every diagonal k is kept for every d, so the path can be walked back afterwards;
+// points past the end of either side are kept as DIFF_NONE so no path goes through them
+// returns -1 without touching match if it takes more than HEAT_DIFF_MAX_EDITS edits
+#define DIFF_NONE (-1000000000)
+
+int editorDiff(struct diffInput* in, int* match) {
+    int n = in->n, m = in->m;
+    int max = n + m < HEAT_DIFF_MAX_EDITS ? n + m : HEAT_DIFF_MAX_EDITS;
+    int* trace = NULL;      //V for d starts at d*d
+    int capacity = 0;       //how many d's trace has room for
+
+    int found = -1;
+    for(int d = 0; d <= max && found < 0; d++) {
+        if(d == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            trace = realloc(trace, sizeof(int) * (size_t)capacity * capacity);
+            if(trace == NULL) die("realloc");
+        }
+        int* v = &trace[(size_t)d * d + d];          //v[k] for k in [-d, d]
+        int* prev = d > 0 ? &trace[(size_t)(d - 1) * (d - 1) + d - 1] : NULL;
+        for(int k = -d; k <= d; k += 2) {
+            int x;
+            if(d == 0) x = 0;
+            else if(k == -d || (k != d && prev[k - 1] < prev[k + 1])) x = prev[k + 1];       //a line was added
+            else x = prev[k - 1] + 1;                                                     //a row was removed
+            int y = x - k;
+            if(x < 0 || x > n || y < 0 || y > m) {
+                v[k] = DIFF_NONE;
+                continue;
+            }
+            while(x < n && y < m && diffEqual(in, x, y)) {
+                x++;
+                y++;
+            }
+            v[k] = x;
+            if(x == n && y == m) {
+                found = d;
+                break;
+            }
+        }
+    }
+    if(found < 0) {
+        free(trace);
+        return -1;
+    }
+
+    //walk back from the end, every diagonal run on the way is a line that stayed
+    for(int j = 0; j < m; j++) match[j] = -1;
+    int x = n, y = m;
+    for(int d = found; d > 0; d--) {
+        int k = x - y;
+        int* prev = &trace[(size_t)(d - 1) * (d - 1) + d - 1];
+        int down = k == -d || (k != d && prev[k - 1] < prev[k + 1]);
+        int prevK = down ? k + 1 : k - 1;
+        int prevX = prev[prevK];
+        int startX = down ? prevX : prevX + 1;
+        for(int t = 0; x - t > startX; t++) {
+            match[y - 1 - t] = x - 1 - t;
+        }
+        x = prevX;
+        y = prevX - prevK;
+    }
+    for(int t = 0; t < x; t++) {
+        match[t] = t;
+    }
+    free(trace);
+    return found;
+}
+
+// a tag seen while looking for lines that are on both sides exactly once, i and j are where it was last seen
+struct diffAnchor {
+    uint32_t tag;                   //0 when the slot is empty
+    int oldCount, newCount;
+    int i, j;
+};
+
+// the hash new line j would have starting normally, what anchors are matched by
+uint32_t diffNormalTag(struct diffInput* in, int j) {
+    if(in->tagIn[j] != HL_STATE_NORMAL) {
+        in->tag[j] = editorKeyTag(editorRowKey(in->text[j], in->length[j], E.syntax, HL_STATE_NORMAL));
+        in->tagIn[j] = HL_STATE_NORMAL;
+    }
+    return in->tag[j];
+}
+
+// for changes too big for editorDiff in one go: lines that are on both sides exactly once are matched up
+// first, the longest run of them that stays in order is kept (patience diff), and editorDiff only has to
+// work out the stretches in between; a stretch that's still too different is replaced, which costs only that
+// stretch. rows can only anchor if they were hashed starting in the normal state, which is most lines of code
+void editorDiffAnchored(struct diffInput* in, int* match) {
+    int n = in->n, m = in->m;
+    int size = 2;
+    while(size < 2 * (n + m)) size *= 2;
+    struct diffAnchor* table = calloc(size, sizeof(struct diffAnchor));
+    if(table == NULL) die("calloc");
+
+    //every tag on both sides counted in an open addressed table that's at most half full
+    for(int k = 0; k < n + m; k++) {
+        uint32_t tag;
+        if(k < n) {
+            erow* row = &in->rows[k];
+            if(row->hash == 0 || editorRowIn(row - E.row) != HL_STATE_NORMAL) continue;
+            tag = row->hash;
+        }else {
+            tag = diffNormalTag(in, k - n);
+        }
+        unsigned int slot = tag & (size - 1);
+        while(table[slot].tag != 0 && table[slot].tag != tag) slot = (slot + 1) & (size - 1);
+        table[slot].tag = tag;
+        if(k < n) {
+            table[slot].oldCount++;
+            table[slot].i = k;
+        }else {
+            table[slot].newCount++;
+            table[slot].j = k - n;
+        }
+    }
+
+    //the unique ones in new line order, and the longest run of them whose old rows go up too
+    int* anchorI = malloc(sizeof(int) * (m + 1));
+    int* anchorJ = malloc(sizeof(int) * (m + 1));
+    int* prev = malloc(sizeof(int) * (m + 1));
+    int* tails = malloc(sizeof(int) * (m + 1));     //tails[l] ends the best run of length l + 1 found so far
+    if(anchorI == NULL || anchorJ == NULL || prev == NULL || tails == NULL) die("malloc");
+    int numAnchors = 0, runLength = 0;
+    for(int j = 0; j < m; j++) {
+        uint32_t tag = in->tag[j];
+        unsigned int slot = tag & (size - 1);
+        while(table[slot].tag != tag) slot = (slot + 1) & (size - 1);
+        struct diffAnchor* a = &table[slot];
+        if(a->oldCount != 1 || a->newCount != 1 || in->rows[a->i].size != in->length[j]) continue;
+
+        int c = numAnchors++;
+        anchorI[c] = a->i;
+        anchorJ[c] = j;
+        int lo = 0, hi = runLength;
+        while(lo < hi) {
+            int mid = (lo + hi) / 2;
+            if(anchorI[tails[mid]] < a->i) lo = mid + 1;
+            else hi = mid;
+        }
+        prev[c] = lo > 0 ? tails[lo - 1] : -1;
+        tails[lo] = c;
+        if(lo == runLength) runLength++;
+    }
+    int* run = tails;               //walked back from its end, it can overwrite tails as it goes
+    for(int c = runLength > 0 ? tails[runLength - 1] : -1, l = runLength - 1; c >= 0; c = prev[c], l--) {
+        run[l] = c;
+    }
+
+    //then every stretch before, between and after the anchors on its own
+    int i0 = 0, j0 = 0;
+    for(int l = 0; l <= runLength; l++) {
+        int i1 = l < runLength ? anchorI[run[l]] : n;
+        int j1 = l < runLength ? anchorJ[run[l]] : m;
+        struct diffInput gap = {in->rows + i0, in->text + j0, in->length + j0, in->tag + j0, in->tagIn + j0, i1 - i0, j1 - j0};
+        int* out = &match[j0];
+        if(editorDiff(&gap, out) >= 0) {
+            for(int j = 0; j < gap.m; j++) {
+                if(out[j] >= 0) out[j] += i0;
+            }
+        }else {
+            for(int j = 0; j < gap.m; j++) out[j] = -1;
+        }
+        if(l < runLength) match[j1] = i1;
+        i0 = i1 + 1;
+        j0 = j1 + 1;
+    }
+
+    free(table);
+    free(anchorI);
+    free(anchorJ);
+    free(prev);
+    free(tails);
+}
+
+// where old row "at" ends up: the same row if it stayed, otherwise the first line after the last row before it that did
+int editorDiffMap(int* match, int m, int at) {
+    for(int j = 0; j < m; j++) {
+        if(match[j] >= at) return j;
+    }
+    return m;
+}
+
+// Ctrl-R, brings the buffer up to date with the file on disk
+void editorReload() {
+    if(E.filename == NULL) return;
+    if(E.hex) {
+        editorHexReload();
+        return;
+    }
+    double started = editorNowUs();
+
+    int fd = open(E.filename, O_RDONLY);
+    struct stat st;
+    if(fd == -1 || fstat(fd, &st) == -1) {
+        editorSetStatusMessage("Can't reload %s: %s", E.filename, strerror(errno));
+        if(fd != -1) close(fd);
+        return;
+    }
+    size_t size = st.st_size;
+    const char* data = size > 0 ? mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0) : "";
+    close(fd);
+    if(data == MAP_FAILED) {
+        editorSetStatusMessage("Can't reload %s: %s", E.filename, strerror(errno));
+        return;
+    }
+    editorYankDetach(-1);
+    editorClearCursors();
+    //when wrapping the top of the screen is a visual line, it stays on the same segment of the same row
+    int seg = 0, top = E.wrap ? editorWrapFind(E.voff, &seg) : E.rowoff;
+
+    //rows that match at the start, compared straight against the file
+    int n = E.numRows, p = 0;
+    size_t pos = 0;
+    while(p < n && pos < size) {
+        const char* nl = memchr(data + pos, '\n', size - pos);
+        size_t end = nl ? (size_t)(nl - data) : size;
+        size_t len = end;
+        while(len > pos && (data[len - 1] == '\n' || data[len - 1] == '\r')) len--;
+        if(!editorLineSame(&E.row[p], data + pos, len - pos)) break;
+        p++;
+        pos = end + 1;
+    }
+    if(pos > size) pos = size;      //the last line had no newline
+
+    //and at the end, walking lines backwards until they'd run into the ones above
+    int s = 0;
+    size_t midEnd = size;           //the lines that didn't match at either end are in [pos, midEnd)
+    while(s < n - p && pos < midEnd) {
+        size_t end = data[midEnd - 1] == '\n' ? midEnd - 1 : midEnd;
+        const char* nl = end > pos ? memrchr(data + pos, '\n', end - pos) : NULL;
+        size_t start = nl ? (size_t)(nl - data) + 1 : pos;
+        size_t len = end;
+        while(len > start && data[len - 1] == '\r') len--;
+        if(!editorLineSame(&E.row[n - 1 - s], data + start, len - start)) break;
+        s++;
+        midEnd = start;
+    }
+
+    //the lines in between get diffed against the rows in between
+    struct diffInput in;
+    in.rows = &E.row[p];
+    in.n = n - p - s;
+    in.m = 0;
+    for(const char* nl = data + pos; nl < data + midEnd; nl++) {
+        nl = memchr(nl, '\n', data + midEnd - nl);
+        if(nl == NULL) break;
+        in.m++;
+    }
+    if(midEnd > pos && data[midEnd - 1] != '\n') in.m++;
+    in.text = malloc(sizeof(char*) * (in.m + 1));
+    in.length = malloc(sizeof(int) * (in.m + 1));
+    in.tag = malloc(sizeof(uint32_t) * (in.m + 1));
+    in.tagIn = malloc(sizeof(int) * (in.m + 1));
+    int* match = malloc(sizeof(int) * (in.m + 1));
+    for(int j = 0; j < in.m; j++) {
+        const char* nl = memchr(data + pos, '\n', midEnd - pos);
+        size_t lineEnd = nl ? (size_t)(nl - data) : midEnd;
+        size_t len = lineEnd;
+        while(len > pos && data[len - 1] == '\r') len--;
+        in.text[j] = data + pos;
+        in.length[j] = len - pos;
+        in.tagIn[j] = -1;
+        pos = lineEnd + 1;
+    }
+    if(editorDiff(&in, match) < 0) editorDiffAnchored(&in, match);
+
+    //only the rows in between are redone: they're set aside, the end moves to where it goes now, and kept
+    //rows go back in between as they are while new lines become new rows
+    int total = p + in.m + s;
+    erow* old = malloc(sizeof(erow) * (in.n + 1));
+    if(old == NULL) die("malloc");
+    memcpy(old, in.rows, sizeof(erow) * in.n);
+    in.rows = old;
+    if(total > n) {
+        E.row = realloc(E.row, sizeof(erow) * total);
+        if(E.row == NULL) die("realloc");
+    }
+    memmove(&E.row[p + in.m], &E.row[n - s], sizeof(erow) * s);
+    int* kept = calloc(in.n + 1, sizeof(int));
+    int* fresh = malloc(sizeof(int) * (in.m + 2));
+    int numFresh = 0, added = 0, removed = 0;
+    for(int j = 0; j < in.m; j++) {
+        erow* row = &E.row[p + j];
+        if(match[j] >= 0) {
+            *row = in.rows[match[j]];
+            kept[match[j]] = 1;
+            //a kept row right after new or removed ones may start in a different state now
+            if(j == 0 ? match[j] != 0 : match[j - 1] < 0 || match[j] != match[j - 1] + 1) fresh[numFresh++] = p + j;
+            continue;
+        }
+        memset(row, 0, sizeof(erow));
+        row->size = in.length[j];
+        row->chars = rbAlloc(row->size + 1);
+        memcpy(row->chars, in.text[j], row->size);
+        row->chars[row->size] = '\0';
+        row->cache = -1;
+        row->hlstate = HL_STATE_NORMAL;
+        fresh[numFresh++] = p + j;
+        added++;
+    }
+    //and the same for the first row of the end that matched
+    if(s > 0 && (in.m == 0 ? in.n != 0 : match[in.m - 1] < 0 || match[in.m - 1] != in.n - 1)) fresh[numFresh++] = p + in.m;
+    for(int i = 0; i < in.n; i++) {
+        if(!kept[i]) {
+            editorFreeRow(&in.rows[i]);
+            removed++;
+        }
+    }
+
+    //the cursor, the top of the screen and the mark stay on the same lines
+    int* moved[] = {&E.cursorY, &E.rowoff, &E.markY, &top};
+    for(int k = 0; k < 4; k++) {
+        int at = *moved[k];
+        if(at >= n - s) *moved[k] = at - n + total;
+        else if(at >= p) *moved[k] = p + editorDiffMap(match, in.m, at - p);
+    }
+
+    free(old);
+    E.numRows = total;
+    editorWrapReplace(p, in.n, in.m);
+    editorBracketReplace(p, in.n, in.m);
+    if(E.cursorY > E.numRows) E.cursorY = E.numRows;
+    if(E.cursorY < E.numRows && E.cursorX > E.row[E.cursorY].size) E.cursorX = E.row[E.cursorY].size;
+
+    //the new rows and the ones after changes are the only ones highlighted again, on every core if that's a lot
+    if(numFresh >= HEAT_PARALLEL_MIN_ROWS) {
+        int to = fresh[numFresh - 1] + 1;
+        editorHighlightSpan(fresh[0], to);
+        editorUpdateRows(&to, 1);                   //carries on below if the last of them ends differently now
+    }else {
+        editorUpdateRows(fresh, numFresh);
+    }
+    if(E.wrap) {
+        if(top >= E.numRows) top = E.numRows > 0 ? E.numRows - 1 : 0;
+        int start = editorWrapRowStart(top);        //brings every row's vlines up to date too
+        if(top < E.numRows && seg >= E.row[top].vlines) seg = E.row[top].vlines - 1;
+        E.voff = start + (top < E.numRows ? seg : 0);
+    }
+
+    if(size > 0) munmap((void*)data, size);
+    free(in.text);
+    free(in.length);
+    free(in.tag);
+    free(in.tagIn);
+    free(match);
+    free(kept);
+    free(fresh);
+
+    E.dirty = 0;
+    //events still queued from the write we just read in would mark it changed again
+    editorCheckDisk(E.watch > 0 ? E.watch : -1);
+    E.diskChanged = 0;
+    editorWatchFile();
+    editorSetStatusMessage("Reloaded, %d lines added and %d removed (%.0fms)", added, removed, (editorNowUs() - started) / 1000);
+}
+
+/*---------------------------------------------------HEX VIEW---------------------------------------------------*/
+
+// a file with a NUL byte near the start is binary, and splitting it into rows on whatever 0x0a bytes it has
+// would be slow and unreadable; it's mapped instead and shown 16 bytes a line, drawn straight from the
+// mapping, so there are no erows at all and opening or scrolling a huge core dump costs the same as a tiny file
+// typing hex digits changes bytes; the changes are kept on the side, sorted by offset, and saving writes only
+// those bytes back into the file where they are
+
+#define HEX_BYTES 16                //bytes on a line
+
+struct hexEdit {
+    long long offset;
+    unsigned char byte;
+};
+
+struct hexView {
+    int fd;                         //kept open for saving, read-only if that's all the file allows
+    const unsigned char* data;      //the whole file, pages are only read in once they're drawn
+    long long mapped;               //how much of it was mapped, which is what gets unmapped
+    long long size;                 //how much of the mapping is still backed by the file, see editorHexClamp
+    struct hexEdit* edits;          //bytes that differ from the file, sorted by offset
+    int numEdits, capacity;
+    int nibble;                     //the cursor is on the low half of its byte
+};
+
+// whether the first few KB of a file have a NUL in them
+int editorIsBinary(const char* filename) {
+    int fd = open(filename, O_RDONLY);
+    if(fd == -1) return 0;
+    char buf[8192];
+    ssize_t n = read(fd, buf, sizeof(buf));
+    close(fd);
+    return n > 0 && memchr(buf, '\0', n) != NULL;
+}
+
+// maps a file for the hex view, NULL with errno set if it can't be
+struct hexView* editorHexMap(char* filename) {
+    int fd = open(filename, O_RDWR | O_CLOEXEC);
+    if(fd == -1) fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if(fd == -1) return NULL;
+    struct stat st;
+    if(fstat(fd, &st) == -1) {
+        close(fd);
+        return NULL;
+    }
+    //lines are counted in ints like rows are
+    if(st.st_size / HEX_BYTES >= INT_MAX) {
+        close(fd);
+        errno = EFBIG;
+        return NULL;
+    }
+    const unsigned char* data = NULL;
+    if(st.st_size > 0) {
+        data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if(data == MAP_FAILED) {
+            int saved = errno;
+            close(fd);
+            errno = saved;
+            return NULL;
+        }
+    }
+
+    struct hexView* h = calloc(1, sizeof(struct hexView));
+    if(h == NULL) die("calloc");
+    h->fd = fd;
+    h->data = data;
+    h->mapped = h->size = st.st_size;
+    return h;
+}
+
+// opens E.filename in the hex view, the buffer has no rows at all
+int editorHexOpen() {
+    E.hex = editorHexMap(E.filename);
+    if(E.hex == NULL) return -1;
+    E.syntax = NULL;
+    E.cursorX = E.cursorY = 0;
+    E.rowoff = E.coloff = E.voff = 0;
+    E.dirty = 0;
+    editorWatchFile();
+    return 0;
+}
+
+void editorHexFree() {
+    if(E.hex == NULL) return;
+    if(E.hex->data) munmap((void*)E.hex->data, E.hex->mapped);
+    close(E.hex->fd);
+    free(E.hex->edits);
+    free(E.hex);
+    E.hex = NULL;
+}
+
+// index of the first edit at or after offset
+int editorHexFind(long long offset) {
+    int lo = 0, hi = E.hex->numEdits;
+    while(lo < hi) {
+        int mid = (lo + hi) / 2;
+        if(E.hex->edits[mid].offset < offset) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// touching pages of the mapping past the end of a file that shrank raises SIGBUS, so anything that reads
+// the mapping first checks the file is still as long as it thinks; edits past the new end are dropped
+void editorHexClamp() {
+    struct hexView* h = E.hex;
+    struct stat st;
+    if(fstat(h->fd, &st) == 0 && st.st_size < h->size) {
+        h->size = st.st_size;
+        h->numEdits = editorHexFind(h->size);
+        E.dirty = h->numEdits;
+    }
+}
+
+// the n bytes from offset as they are now, changed[i] is set for the ones that were edited
+// returns how many there were, fewer than n if the file ends first
+int editorHexRead(long long offset, int n, unsigned char* bytes, int* changed) {
+    editorHexClamp();
+    if(offset >= E.hex->size) return 0;
+    if(n > E.hex->size - offset) n = E.hex->size - offset;
+    memcpy(bytes, E.hex->data + offset, n);
+    memset(changed, 0, sizeof(int) * n);
+    for(int k = editorHexFind(offset); k < E.hex->numEdits && E.hex->edits[k].offset < offset + n; k++) {
+        int i = E.hex->edits[k].offset - offset;
+        bytes[i] = E.hex->edits[k].byte;
+        changed[i] = 1;
+    }
+    return n;
+}
+
+// changes a byte; putting back what the file has drops the edit again
+void editorHexWrite(long long offset, unsigned char byte) {
+    struct hexView* h = E.hex;
+    editorHexClamp();
+    if(offset >= h->size) return;
+    int k = editorHexFind(offset);
+    int found = k < h->numEdits && h->edits[k].offset == offset;
+    if(byte == h->data[offset]) {
+        if(found) {
+            memmove(&h->edits[k], &h->edits[k + 1], sizeof(struct hexEdit) * (h->numEdits - k - 1));
+            h->numEdits--;
+        }
+    }else if(found) {
+        h->edits[k].byte = byte;
+    }else {
+        if(h->numEdits == h->capacity) {
+            h->capacity = h->capacity ? h->capacity * 2 : 64;
+            h->edits = realloc(h->edits, sizeof(struct hexEdit) * h->capacity);
+            if(h->edits == NULL) die("realloc");
+        }
+        memmove(&h->edits[k + 1], &h->edits[k], sizeof(struct hexEdit) * (h->numEdits - k));
+        h->edits[k].offset = offset;
+        h->edits[k].byte = byte;
+        h->numEdits++;
+    }
+    E.dirty = h->numEdits;
+}
+
+// writes the changed bytes into the file in place, a run of neighbouring ones at a time
+void editorHexSave() {
+    struct hexView* h = E.hex;
+    editorHexClamp();
+    unsigned char run[4096];
+    int k = 0;
+    while(k < h->numEdits) {
+        long long start = h->edits[k].offset;
+        int n = 0;
+        while(k < h->numEdits && h->edits[k].offset == start + n && n < (int)sizeof(run)) {
+            run[n++] = h->edits[k++].byte;
+        }
+        if(pwrite(h->fd, run, n, start) != n) {
+            editorSetStatusMessage("Can't save, I/O error: %s", strerror(errno));
+            return;
+        }
+    }
+
+    //the mapping shares the page cache with the file, so it already shows what was just written
+    int written = h->numEdits;
+    h->numEdits = 0;
+    E.dirty = 0;
+    editorCheckDisk(E.watch > 0 ? E.watch : -1);
+    E.diskChanged = 0;
+    editorWatchFile();
+    editorSetStatusMessage("%d bytes written to disk in place", written);
+}
+
+// Ctrl-R in the hex view, maps the file again since it may have changed size
+void editorHexReload() {
+    struct hexView* h = editorHexMap(E.filename);
+    if(h == NULL) {
+        editorSetStatusMessage("Can't reload %s: %s", E.filename, strerror(errno));
+        return;
+    }
+    editorHexFree();
+    E.hex = h;
+    E.dirty = 0;
+    editorCheckDisk(E.watch > 0 ? E.watch : -1);
+    E.diskChanged = 0;
+    editorWatchFile();
+    editorSetStatusMessage("Reloaded, %lld bytes", h->size);
+}
+
+int editorHexLines() {
+    return (E.hex->size + HEX_BYTES - 1) / HEX_BYTES;
+}
+
+long long editorHexOffset() {
+    return (long long)E.cursorY * HEX_BYTES + E.cursorX;
+}
+
+// keeps the cursor on a byte of the file and the screen on the cursor; rx is the screen column it's drawn at
+void editorHexScroll() {
+    long long offset = editorHexOffset();
+    if(offset >= E.hex->size) offset = E.hex->size > 0 ? E.hex->size - 1 : 0;
+    E.cursorY = offset / HEX_BYTES;
+    E.cursorX = offset % HEX_BYTES;
+
+    if(E.cursorY < E.rowoff) E.rowoff = E.cursorY;
+    if(E.cursorY >= E.rowoff + E.rows) E.rowoff = E.cursorY - E.rows + 1;
+    E.voff = E.rowoff;              //so scrolling the screen works the same with soft wrap on
+    E.coloff = 0;
+    E.rx = 12 + 3 * E.cursorX + (E.cursorX >= HEX_BYTES / 2) + E.hex->nibble;
+}
+
+// like editorScrollLines
+void editorHexScrollLines(int lines) {
+    int total = editorHexLines();
+    int last = total - E.rows > E.rowoff ? total - E.rows : E.rowoff;
+    E.rowoff += lines;
+    if(E.rowoff > last) E.rowoff = last;
+    if(E.rowoff < 0) E.rowoff = 0;
+    E.cursorY += lines;
+    if(E.cursorY >= total) E.cursorY = total - 1;
+    if(E.cursorY < 0) E.cursorY = 0;
+}
+
+// Ctrl-G in the hex view, takes decimal or 0x offsets
+void editorHexGoTo() {
+    char* input = editorPrompt("Go to offset: %s (ESC to cancel)");
+    if(input == NULL) return;
+
+    char* end;
+    long long offset = strtoll(input, &end, 0);
+    if(end == input || *end != '\0' || offset < 0) {
+        editorSetStatusMessage("Not an offset: %s", input);
+        free(input);
+        return;
+    }
+    free(input);
+
+    if(offset >= E.hex->size) offset = E.hex->size > 0 ? E.hex->size - 1 : 0;
+    E.cursorY = offset / HEX_BYTES;
+    E.cursorX = offset % HEX_BYTES;
+    E.hex->nibble = 0;
+    E.rowoff = E.cursorY - E.rows / 2;
+    if(E.rowoff < 0) E.rowoff = 0;
+}
+
+// the keys that mean something else in the hex view, returns 0 for the ones that work as usual
+int editorHexKey(int c) {
+    struct hexView* h = E.hex;
+    editorHexClamp();
+    int digit = -1;
+    if(c >= '0' && c <= '9') digit = c - '0';
+    if(c >= 'a' && c <= 'f') digit = c - 'a' + 10;
+    if(c >= 'A' && c <= 'F') digit = c - 'A' + 10;
+
+    if(digit >= 0) {
+        long long offset = editorHexOffset();
+        unsigned char byte;
+        int changed;
+        if(editorHexRead(offset, 1, &byte, &changed) == 0) return 1;
+        byte = h->nibble ? (byte & 0xf0) | digit : (byte & 0x0f) | digit << 4;
+        editorHexWrite(offset, byte);
+        if(!h->nibble) {
+            h->nibble = 1;
+        }else if(offset + 1 < h->size) {
+            h->nibble = 0;
+            E.cursorX++;
+            if(E.cursorX == HEX_BYTES) {
+                E.cursorX = 0;
+                E.cursorY++;
+            }
+        }
+        return 1;
+    }
+
+    switch(c) {
+        case ARROW_LEFT: case BACKSPACE: case CTRL_KEY('h'):
+            if(h->nibble) h->nibble = 0;
+            else if(E.cursorX > 0) E.cursorX--;
+            else if(E.cursorY > 0) {
+                E.cursorY--;
+                E.cursorX = HEX_BYTES - 1;
+            }
+            return 1;
+        case ARROW_RIGHT:
+            h->nibble = 0;
+            if(editorHexOffset() + 1 >= h->size) return 1;
+            if(++E.cursorX == HEX_BYTES) {
+                E.cursorX = 0;
+                E.cursorY++;
+            }
+            return 1;
+        case ARROW_UP:
+            if(E.cursorY > 0) E.cursorY--;
+            return 1;
+        case ARROW_DOWN:
+            if(E.cursorY + 1 < editorHexLines()) E.cursorY++;
+            return 1;
+        case HOME_KEY:
+            E.cursorX = 0;
+            h->nibble = 0;
+            return 1;
+        case END_KEY:
+            E.cursorX = HEX_BYTES - 1;
+            h->nibble = 0;
+            return 1;
+        case PAGE_UP: case PAGE_DOWN:
+            editorHexScrollLines(c == PAGE_UP ? -E.rows : E.rows);
+            return 1;
+        case CTRL_KEY('u'): case CTRL_KEY('d'):
+            editorHexScrollLines((c == CTRL_KEY('u') ? -1 : 1) * (E.rows / 2 > 0 ? E.rows / 2 : 1));
+            return 1;
+        case CTRL_KEY('g'):
+            editorHexGoTo();
+            return 1;
+        //saving, quitting, reloading and switching buffers are the same as for text
+        case CTRL_KEY('z'): case CTRL_KEY('s'): case CTRL_KEY('r'): case CTRL_KEY('o'):
+        case CTRL_KEY('b'): case CTRL_KEY('w'): case CTRL_KEY('e'): case CTRL_KEY('n'): case CTRL_KEY('l'):
+            return 0;
+    }
+    return 1;
+}
+
+/*---------------------------------------------------BUFFERS---------------------------------------------------*/
+
+// copies the active buffer out of E into its slot
+void editorStashBuffer(struct editorBuffer* b) {
+    b->row = E.row;
+    b->numRows = E.numRows;
+    b->cursorX = E.cursorX;
+    b->cursorY = E.cursorY;
+    b->rx = E.rx;
+    b->rowoff = E.rowoff;
+    b->coloff = E.coloff;
+    b->dirty = E.dirty;
+    b->filename = E.filename;
+    b->syntax = E.syntax;
+    b->voff = E.voff;
+    b->wraptree = E.wraptree;
+    b->wrapRows = E.wrapRows;
+    b->wrapWidth = E.wrapWidth;
+    b->wrapStale = E.wrapStale;
+    b->wrapSize = E.wrapSize;
+    b->cursors = E.cursors;
+    b->numCursors = E.numCursors;
+    b->block = E.block;
+    b->blockX = E.blockX;
+    b->blockY = E.blockY;
+    b->mark = E.mark;
+    b->markY = E.markY;
+    b->brackettree = E.brackettree;
+    b->bracketRows = E.bracketRows;
+    b->bracketSize = E.bracketSize;
+    b->bracketStale = E.bracketStale;
+    b->watch = E.watch;
+    b->diskChanged = E.diskChanged;
+    b->hex = E.hex;
+}
+
+// makes a parked buffer the active one, nothing is recomputed so switching is instant
+void editorLoadBuffer(struct editorBuffer* b) {
+    E.row = b->row;
+    E.numRows = b->numRows;
+    E.cursorX = b->cursorX;
+    E.cursorY = b->cursorY;
+    E.rx = b->rx;
+    E.rowoff = b->rowoff;
+    E.coloff = b->coloff;
+    E.dirty = b->dirty;
+    E.filename = b->filename;
+    E.syntax = b->syntax;
+    E.voff = b->voff;
+    E.wraptree = b->wraptree;
+    E.wrapRows = b->wrapRows;
+    E.wrapWidth = b->wrapWidth;
+    E.wrapStale = b->wrapStale;
+    E.wrapSize = b->wrapSize;
+    E.cursors = b->cursors;
+    E.numCursors = b->numCursors;
+    E.block = b->block;
+    E.blockX = b->blockX;
+    E.blockY = b->blockY;
+    E.mark = b->mark;
+    E.markY = b->markY;
+    E.brackettree = b->brackettree;
+    E.bracketRows = b->bracketRows;
+    E.bracketSize = b->bracketSize;
+    E.bracketStale = b->bracketStale;
+    E.watch = b->watch;
+    E.diskChanged = b->diskChanged;
+    E.hex = b->hex;
+}
+
+void editorSwitchBuffer(int at) {
+    if(at < 0 || at >= E.numBuffers || at == E.curBuffer) return;
+    editorStashBuffer(&E.buffers[E.curBuffer]);
+    E.curBuffer = at;
+    editorLoadBuffer(&E.buffers[at]);
+}
+
+// adds an empty buffer at the end and makes it the active one; when split, it takes over the active pane
+void editorNewBuffer() {
+    int was = E.curBuffer;
+    editorStashBuffer(&E.buffers[E.curBuffer]);
+    E.buffers = realloc(E.buffers, sizeof(struct editorBuffer) * (E.numBuffers + 1));
+    memset(&E.buffers[E.numBuffers], 0, sizeof(struct editorBuffer));
+    E.curBuffer = E.numBuffers++;
+    editorLoadBuffer(&E.buffers[E.curBuffer]);
+    if(E.split) {
+        if(E.splitBottom == was) E.splitBottom = E.curBuffer;
+        else E.splitTop = E.curBuffer;
+        E.rows = editorPaneRows(E.curBuffer == E.splitBottom);
+    }
+}
+
+// frees the active buffer and falls back to the one before it
+void editorCloseBuffer() {
+    if(E.numBuffers == 1) return;
+
+    editorYankDetach(-1);
+    editorUnwatchFile();
+    editorHexFree();
+    for(int i = 0; i < E.numRows; i++) {
+        editorFreeRow(&E.row[i]);
+    }
+    free(E.row);
+    free(E.filename);
+    free(E.wraptree);
+    free(E.cursors);
+    free(E.brackettree);
+
+    int closed = E.curBuffer;
+    memmove(&E.buffers[closed], &E.buffers[closed + 1], sizeof(struct editorBuffer) * (E.numBuffers - closed - 1));
+    E.numBuffers--;
+    E.curBuffer = closed > 0 ? closed - 1 : 0;
+    editorLoadBuffer(&E.buffers[E.curBuffer]);
+
+    //the pane it was in shows the buffer before it instead, unless the other pane already does
+    if(E.split) {
+        int* pane = E.splitTop == closed ? &E.splitTop : &E.splitBottom;
+        int* other = pane == &E.splitTop ? &E.splitBottom : &E.splitTop;
+        if(*other > closed) (*other)--;
+        *pane = E.curBuffer;
+        if(*other == E.curBuffer) E.split = 0;
+    }
+    E.rows = E.split ? editorPaneRows(E.curBuffer == E.splitBottom) : E.screenrows;
+}
+
+// returns the number of buffers with unsaved changes
+int editorDirtyBuffers() {
+    int count = E.dirty ? 1 : 0;
+    for(int i = 0; i < E.numBuffers; i++) {
+        if(i != E.curBuffer && E.buffers[i].dirty) count++;
+    }
+    return count;
+}
+
+// asks for a file name and opens it in a new buffer, reusing the current one if it's still empty
+void editorOpenBuffer() {
+    char* filename = editorPrompt("Open: %s (ESC to cancel)");
+    if(filename == NULL) return;
+
+    int reuse = E.filename == NULL && E.numRows == 0 && !E.dirty;
+    if(!reuse) editorNewBuffer();
 
-    char* buf = malloc(totalLen);
-    char* p = buf;
-    for(j = 0; j < E.numRows; j++) {
-        memcpy(p, E.row[j].chars, E.row[j].size);
-        p += E.row[j].size;
-        *p = '\n';
-        p++;
+    if(editorOpen(filename) == -1) {
+        editorSetStatusMessage("Can't open %s: %s", filename, strerror(errno));
+        if(!reuse) editorCloseBuffer();
+        else {
+            free(E.filename);
+            E.filename = NULL;
+        }
     }
+    free(filename);
+}
 
-    return buf;
-
+// the pane heights when split, the top pane gets its own status bar as a separator
+int editorPaneRows(int bottom) {
+    int top = (E.screenrows - 1) / 2;
+    return bottom ? E.screenrows - 1 - top : top;
 }
 
-// uses string from function above and saves to disk
-void editorSave() {
-    if(E.filename == NULL) {
-        E.filename = editorPrompt("Save as: %s (ESC to cancel)");
+// splits the screen between the active buffer and another one; with a single buffer the
+// same file is opened again, which shares all of its rows with the first copy
+void editorToggleSplit() {
+    if(E.split) {
+        E.split = 0;
+        E.rows = E.screenrows;
+        return;
+    }
+
+    int top = E.curBuffer;
+    if(E.numBuffers == 1) {
         if(E.filename == NULL) {
-            editorSetStatusMessage("Save aborted");
+            editorSetStatusMessage("Open another file (Ctrl-O) or save this one before splitting");
             return;
         }
-        editorSelectSyntaxHighlight();
+        char* filename = strdup(E.filename);
+        editorNewBuffer();
+        if(editorOpen(filename) == -1) {
+            editorCloseBuffer();
+            editorSetStatusMessage("Can't split: %s", strerror(errno));
+            free(filename);
+            return;
+        }
+        free(filename);
+        editorSwitchBuffer(top);
     }
 
-    int len;
-    char* buf = editorRowsToString(&len);
-    int fd = open(E.filename, O_RDWR | O_CREAT, 0644);      // using the fcntl.h library
+    E.split = 1;
+    E.splitTop = top;
+    E.splitBottom = (top + 1) % E.numBuffers;
+    E.rows = editorPaneRows(0);
+}
 
-    if(fd != -1) {
-        if(ftruncate(fd, len) != -1) {
-            if(write(fd, buf, len) == len) {
-                close(fd);
-                free(buf);
-                E.dirty = 0;
-                editorSetStatusMessage("%d bytes written to disk", len);
-                return;
-            }
-       }
-       close(fd);
+// moves to the next buffer, when split this just moves the focus to the other pane
+void editorNextBuffer() {
+    if(E.split) {
+        int other = E.curBuffer == E.splitTop ? E.splitBottom : E.splitTop;
+        E.rows = editorPaneRows(other == E.splitBottom);
+        editorSwitchBuffer(other);
+        return;
     }
-
-    free(buf);
-    editorSetStatusMessage("Can't save, I/O error: %s", strerror(errno));
+    editorSwitchBuffer((E.curBuffer + 1) % E.numBuffers);
 }
 
 /*----------------------------------------------APPEND BUFFER--------------------------------------------------*/
@@ -625,22 +4211,28 @@ struct abuf {
     //char* is used instead of *string because dynamic string not supported in C
     char* bufferString;
     int length;
+    int capacity;           //how much is allocated, grows by doubling so appends are cheap
 };
 
 //this statement says that ABUF_INIT is an empty abuf struct; kind of like a constructor
-#define ABUF_INIT {NULL, 0}
+#define ABUF_INIT {NULL, 0, 0}
 
 void abAppend(struct abuf* ab, const char* s, int length) {
-    //this reallocates more space (adding the length) to memory 
-    char* new = realloc(ab->bufferString, ab->length + length);
+    //this reallocates more space (doubling it, so most appends don't need to) to memory 
+    if(ab->length + length > ab->capacity) {
+        int capacity = ab->capacity ? ab->capacity : 1024;
+        while(capacity < ab->length + length) capacity *= 2;
 
-    if(new == NULL) {
-        return;
+        char* new = realloc(ab->bufferString, capacity);
+        if(new == NULL) {
+            return;
+        }
+        ab->bufferString = new;
+        ab->capacity = capacity;
     }
 
-    //now we copy the original string to the end of the larger, newly created one
-    memcpy(&new[ab->length], s, length);
-    ab->bufferString = new;
+    //now we copy the string to the end of the buffer
+    memcpy(&ab->bufferString[ab->length], s, length);
     ab->length += length;
 }
 
@@ -650,15 +4242,357 @@ void abFree(struct abuf* ab) {
 }
 
 
+/*-------------------------------------------------------WRITER--------------------------------------------------*/
+
+// frames go out to the terminal from a thread of their own, on a nonblocking fd, so a slow link (ssh) never
+// holds up reading keys; the main thread only hands the finished frame over
+// only the newest frame is worth sending: if one is still waiting when the next is drawn, the waiting one is
+// dropped and S goes back to what it was before that frame, so the next one also sends what it would have
+// a frame the thread has started on is always finished, so the terminal never gets half an escape sequence
+
+struct outputWriter {
+    pthread_mutex_t lock;
+    pthread_cond_t wake;            //something to send
+    pthread_cond_t idle;            //everything was sent
+    int fd;                         //the terminal opened again, so O_NONBLOCK doesn't reach stdin; -1 without a thread
+    int busy;                       //the thread is writing something
+    struct abuf frame;              //the newest frame, if it hasn't been started yet
+    struct abuf extra;              //what can't be dropped (the clipboard), sent before the frame
+    uint64_t* lines;                //S.lines, S.pane and S.epoch from right before the waiting frame was drawn
+    struct paneState pane[2];
+    unsigned long epoch;
+    unsigned long frames, dropped;
+};
+struct outputWriter W = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER, -1, 0,
+    ABUF_INIT, ABUF_INIT, NULL, {{-1, 0, 0, 0, 0}, {-1, 0, 0, 0, 0}}, 0, 0, 0};
+
+// writes all of s, waiting whenever the terminal can't take more; gives up if the terminal is gone
+void writerSend(const char* s, int len) {
+    int done = 0;
+    while(done < len) {
+        ssize_t n = write(W.fd, s + done, len - done);
+        if(n > 0) {
+            done += n;
+        }else if(n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            struct pollfd pfd = {W.fd, POLLOUT, 0};
+            poll(&pfd, 1, -1);
+        }else if(n == -1 && errno != EINTR) {
+            return;
+        }
+    }
+}
+
+void* writerMain(void* arg) {
+    (void)arg;
+    pthread_mutex_lock(&W.lock);
+    while(1) {
+        if(W.extra.length == 0 && W.frame.length == 0) {
+            W.busy = 0;
+            pthread_cond_broadcast(&W.idle);
+            pthread_cond_wait(&W.wake, &W.lock);
+            continue;
+        }
+        //taking it means it can't be dropped anymore
+        struct abuf* from = W.extra.length > 0 ? &W.extra : &W.frame;
+        struct abuf out = *from;
+        struct abuf empty = ABUF_INIT;
+        *from = empty;
+        W.busy = 1;
+        pthread_mutex_unlock(&W.lock);
+
+        writerSend(out.bufferString, out.length);
+        abFree(&out);
+        pthread_mutex_lock(&W.lock);
+    }
+    return NULL;
+}
+
+// starts the thread, if stdout is a terminal that can be opened again; otherwise frames are written directly
+void editorStartWriter() {
+    char* tty = ttyname(STDOUT_FILENO);
+    if(tty == NULL) return;
+    W.fd = open(tty, O_WRONLY | O_NONBLOCK | O_NOCTTY | O_CLOEXEC);
+    if(W.fd == -1) return;
+    pthread_t thread;
+    sigset_t mask;
+    editorBlockResize(&mask);
+    int failed = pthread_create(&thread, NULL, writerMain, NULL) != 0;
+    pthread_sigmask(SIG_SETMASK, &mask, NULL);
+    if(failed) {
+        close(W.fd);
+        W.fd = -1;
+        return;
+    }
+    pthread_detach(thread);
+}
+
+// called right before a frame is drawn: a frame that's still waiting is dropped, and S is put back so this
+// one is drawn against what the terminal will actually have; then S is kept in case this one gets dropped too
+void editorOutputReclaim() {
+    if(W.fd == -1) return;
+    pthread_mutex_lock(&W.lock);
+    if(W.frame.length > 0) {
+        //a resize in between threw S away already, which is just as good
+        if(W.epoch == S.epoch) {
+            memcpy(S.lines, W.lines, sizeof(uint64_t) * S.numLines);
+            memcpy(S.pane, W.pane, sizeof(S.pane));
+        }
+        abFree(&W.frame);
+        struct abuf empty = ABUF_INIT;
+        W.frame = empty;
+        W.dropped++;
+    }
+    pthread_mutex_unlock(&W.lock);
+
+    //only the main thread touches these, the thread never looks at them
+    W.lines = realloc(W.lines, sizeof(uint64_t) * S.numLines);
+    if(W.lines == NULL) die("realloc");
+    memcpy(W.lines, S.lines, sizeof(uint64_t) * S.numLines);
+    memcpy(W.pane, S.pane, sizeof(S.pane));
+    W.epoch = S.epoch;
+}
+
+// hands a finished frame to the thread, which owns it from then on
+void editorOutputFrame(struct abuf* ab) {
+    W.frames++;
+    if(W.fd == -1) {
+        write(STDOUT_FILENO, ab->bufferString, ab->length);
+        abFree(ab);
+        return;
+    }
+    pthread_mutex_lock(&W.lock);
+    W.frame = *ab;
+    pthread_cond_signal(&W.wake);
+    pthread_mutex_unlock(&W.lock);
+}
+
+// bytes that have to get there, in order with each other
+void editorOutputWrite(const char* s, int len) {
+    if(W.fd == -1) {
+        write(STDOUT_FILENO, s, len);
+        return;
+    }
+    pthread_mutex_lock(&W.lock);
+    abAppend(&W.extra, s, len);
+    pthread_cond_signal(&W.wake);
+    pthread_mutex_unlock(&W.lock);
+}
+
+// waits until the thread has sent everything, before writing to the terminal directly
+void editorOutputFlush() {
+    if(W.fd == -1) return;
+    pthread_mutex_lock(&W.lock);
+    while(W.busy || W.extra.length > 0 || W.frame.length > 0) {
+        pthread_cond_wait(&W.idle, &W.lock);
+    }
+    pthread_mutex_unlock(&W.lock);
+}
+
+/*---------------------------------------------------YANK REGISTER----------------------------------------------*/
+
+// Ctrl-K marks the line the cursor is on, then Ctrl-C copies every line from there to the cursor (or just the
+// cursor's line with no mark), Ctrl-X cuts them and Ctrl-V pastes them above the cursor
+// copying only remembers which rows of which buffer it was, so it costs the same for one line or a million;
+// the first time anything is about to change those rows, editorYankSnapshot copies the erows themselves and
+// retains their chars, which shares the text copy-on-write instead of copying it
+// with HEAT_OSC52 set, copies also go to the terminal's clipboard through an OSC 52 escape sequence
+
+void editorYankClear() {
+    if(Y.source == NULL) {
+        for(int i = 0; i < Y.numRows; i++) {
+            editorFreeRow(&Y.rows[i]);
+        }
+        free(Y.rows);
+    }
+    Y.source = NULL;
+    Y.rows = NULL;
+    Y.numRows = 0;
+}
+
+// turns a reference into rows of its own, from then on the register doesn't care what happens to the buffer
+void editorYankSnapshot() {
+    if(Y.source == NULL) return;
+    erow* rows = malloc(sizeof(erow) * Y.numRows);
+    if(rows == NULL) die("malloc");
+    memcpy(rows, &Y.source[Y.start], sizeof(erow) * Y.numRows);
+    for(int i = 0; i < Y.numRows; i++) {
+        rbRetain(rows[i].chars);
+        if(rows[i].cold) rows[i].cold->refs++;
+        rows[i].cache = -1;
+    }
+    Y.rows = rows;
+    Y.source = NULL;
+}
+
+// called before rows of the active buffer change, "at" is the first row that does, -1 for all of them
+void editorYankDetach(int at) {
+    if(Y.source == NULL || Y.source != E.row) return;
+    if(at >= Y.start + Y.numRows) return;      //only rows below the yank moved or changed
+    editorYankSnapshot();
+}
+
+void editorMarkRange(int* start, int* end) {
+    int from = E.mark ? E.markY : E.cursorY;
+    if(from >= E.numRows) from = E.numRows - 1;
+    int to = E.cursorY < E.numRows ? E.cursorY : E.numRows - 1;
+    *start = from < to ? from : to;
+    *end = (from < to ? to : from) + 1;
+}
+
+static const char base64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// hands the yanked text to the terminal, which puts it on the system clipboard if it supports OSC 52
+void editorYankExport() {
+    if(getenv("HEAT_OSC52") == NULL) return;
+    erow* rows = Y.source ? &Y.source[Y.start] : Y.rows;
+    long long size = 0;
+    for(int i = 0; i < Y.numRows; i++) {
+        size += rows[i].size + 1;
+    }
+    if(size > HEAT_OSC52_MAX) {
+        editorSetStatusMessage("%d lines copied (too big for the terminal clipboard)", Y.numRows);
+        return;
+    }
+
+    struct abuf ab = ABUF_INIT;
+    abAppend(&ab, "\x1b]52;c;", 7);
+    unsigned int bits = 0;
+    int have = 0;
+    char out[4];
+    for(int i = 0; i < Y.numRows; i++) {
+        char* text = editorRowText(&rows[i], &CS.view);
+        for(int j = 0; j <= rows[i].size; j++) {
+            //every line ends in a newline, which is where its nul is
+            bits = (bits << 8) | (unsigned char)(j < rows[i].size ? text[j] : '\n');
+            if(++have == 3) {
+                for(int k = 0; k < 4; k++) out[k] = base64[(bits >> (18 - 6 * k)) & 63];
+                abAppend(&ab, out, 4);
+                bits = have = 0;
+            }
+        }
+    }
+    if(have > 0) {
+        bits <<= 8 * (3 - have);
+        for(int k = 0; k < 4; k++) out[k] = k <= have ? base64[(bits >> (18 - 6 * k)) & 63] : '=';
+        abAppend(&ab, out, 4);
+    }
+    abAppend(&ab, "\x07", 1);
+    editorOutputWrite(ab.bufferString, ab.length);
+    abFree(&ab);
+}
+
+// Ctrl-C
+void editorCopy() {
+    if(E.numRows == 0) return;
+    int start, end;
+    editorMarkRange(&start, &end);
+    editorYankClear();
+    Y.source = E.row;
+    Y.start = start;
+    Y.numRows = end - start;
+    Y.syntax = E.syntax;
+    E.mark = 0;
+    editorSetStatusMessage("%d lines copied", Y.numRows);
+    editorYankExport();
+}
+
+// Ctrl-X, the rows move into the register as they are, nothing is copied or freed
+void editorCut() {
+    if(E.numRows == 0) return;
+    int start, end;
+    editorMarkRange(&start, &end);
+    int n = end - start;
+    editorYankClear();
+    editorYankDetach(start);
+    Y.rows = malloc(sizeof(erow) * n);
+    if(Y.rows == NULL) die("malloc");
+    memcpy(Y.rows, &E.row[start], sizeof(erow) * n);
+    for(int i = 0; i < n; i++) {
+        editorCacheDrop(&Y.rows[i]);
+    }
+    Y.numRows = n;
+    Y.syntax = E.syntax;
+
+    int was = E.row[end - 1].hlstate;
+    memmove(&E.row[start], &E.row[end], sizeof(erow) * (E.numRows - end));
+    E.numRows -= n;
+    editorWrapReplace(start, n, 0);
+    editorBracketReplace(start, n, 0);
+    E.dirty++;
+    int in = start > 0 ? E.row[start - 1].hlstate : HL_STATE_NORMAL;
+    if(start < E.numRows && was != in) editorUpdateSyntax(&E.row[start]);
+
+    E.mark = 0;
+    E.cursorY = start;
+    E.cursorX = 0;
+    editorSetStatusMessage("%d lines cut", n);
+    editorYankExport();
+}
+
+// Ctrl-V, all the rows go in with one memmove and keep the end states they had, so highlighting only
+// has to redo them if they now start in a different state than where they came from
+void editorPaste() {
+    editorYankSnapshot();
+    if(Y.numRows == 0) return;
+    int at = E.cursorY, n = Y.numRows;
+    E.row = realloc(E.row, sizeof(erow) * (E.numRows + n));
+    if(E.row == NULL) die("realloc");
+    memmove(&E.row[at + n], &E.row[at], sizeof(erow) * (E.numRows - at));
+    memcpy(&E.row[at], Y.rows, sizeof(erow) * n);
+    for(int i = at; i < at + n; i++) {
+        rbRetain(E.row[i].chars);
+        if(E.row[i].cold) E.row[i].cold->refs++;
+    }
+    E.numRows += n;
+    editorWrapReplace(at, 0, n);
+    editorBracketReplace(at, 0, n);
+    E.dirty++;
+
+    if(Y.syntax != E.syntax) {
+        //states and brackets from another language mean nothing here, so every pasted row is redone
+        int* rows = malloc(sizeof(int) * n);
+        if(rows == NULL) die("malloc");
+        for(int i = 0; i < n; i++) {
+            E.row[at + i].hash = 0;
+            rows[i] = at + i;
+        }
+        editorUpdateRows(rows, n);
+        free(rows);
+    }else {
+        editorUpdateSyntax(&E.row[at]);
+    }
+    if(at + n < E.numRows) editorUpdateSyntax(&E.row[at + n]);
+    E.cursorY += n;
+    editorSetStatusMessage("%d lines pasted", n);
+}
+
 /*---------------------------------------------------OUTPUT------------------------------------------------------*/
 
 //lets the person scroll down on the editor
 void editorScroll() {
+    if(E.hex) {
+        editorHexScroll();
+        return;
+    }
     E.rx = 0;
     if(E.cursorY < E.numRows) {
         E.rx = editorRowCursorXToRx(&E.row[E.cursorY], E.cursorX);
     }
 
+    //when wrapping there's no sideways scrolling, the offset counts visual lines instead
+    if(E.wrap) {
+        int width = editorWrapWidth();
+        int cv = editorWrapRowStart(E.cursorY) + E.rx / width;
+        if(cv < E.voff) {
+            E.voff = cv;
+        }
+        if(cv >= E.voff + E.rows) {
+            E.voff = cv - E.rows + 1;
+        }
+        E.coloff = 0;
+        return;
+    }
+
     //if the cursor is going up the screen
     if(E.cursorY < E.rowoff) {
         E.rowoff = E.cursorY;
@@ -670,18 +4604,287 @@ void editorScroll() {
     if(E.rx < E.coloff) {
         E.coloff = E.rx;
     }
-    if(E.rx >= E.coloff + E.cols) {
-        E.coloff = E.rx - E.cols + 1;
+    if(E.rx >= E.coloff + editorTextCols()) {
+        E.coloff = E.rx - editorTextCols() + 1;
+    }
+
+}
+
+// turns reverse video (for HL_SELECTED) and underline (for HL_MATCH) on or off, styles are those bits shifted down
+void editorDrawStyle(struct abuf* ab, int was, int now) {
+    int selected = HL_SELECTED >> 6, match = HL_MATCH >> 6;
+    if((now & selected) && !(was & selected)) abAppend(ab, "\x1b[7m", 4);
+    if(!(now & selected) && (was & selected)) abAppend(ab, "\x1b[27m", 5);
+    if((now & match) && !(was & match)) abAppend(ab, "\x1b[4m", 4);
+    if(!(now & match) && (was & match)) abAppend(ab, "\x1b[24m", 5);
+}
+
+// switches the terminal color if the highlight changed
+// current_color is the color last sent plus 1000 times the styles that are on
+void editorDrawColor(struct abuf* ab, int hl, int* current_color) {
+    int style = (hl & (HL_SELECTED | HL_MATCH)) >> 6;
+    hl &= ~(HL_SELECTED | HL_MATCH);
+    int color = hl == HL_NORMAL ? -1 : editorSyntaxToColor(hl);
+    int now = color + 1000 * style;
+    if(now == *current_color) return;
+
+    int was = (*current_color + 1) / 1000;
+    int wasColor = *current_color - 1000 * was;
+    *current_color = now;
+    editorDrawStyle(ab, was, style);
+    if(color == wasColor) return;
+    if(color == -1) {
+        abAppend(ab, "\x1b[39m", 5);    // set to the default color
+    }else {
+        char buf[16];
+        int clen = snprintf(buf, sizeof(buf), "\x1b[38;5;%dm", color);
+        abAppend(ab, buf, clen);
+    }
+}
+
+// puts the colors back to normal at the end of a segment, "tail" draws an extra cursor sitting past the end of the row
+void editorDrawColorEnd(struct abuf* ab, int current_color, int tail) {
+    editorDrawStyle(ab, (current_color + 1) / 1000, 0);
+    abAppend(ab, "\x1b[39m", 5);
+    if(tail) abAppend(ab, "\x1b[7m \x1b[27m", 10);
+}
+
+// draws the part of a row starting at screen column "start", as much of it as fits next to the gutter
+// "wrapped" is set for soft wrap segments, where a wide character cut in half by the previous
+// segment is drawn whole at the start of this one instead of being left out
+void editorDrawRowSegment(struct abuf* ab, erow* row, int start, int wrapped) {
+    struct rowRender* r = editorRowRender(row);
+    char* c = r->render;
+    int rsize = r->rsize;
+    int current_color = -1;
+    int cols = editorTextCols();
+    int tail = 0;
+    unsigned char* hl = editorMarkRow(row, r, &tail);
+
+    //pure ASCII rows have one byte per column, so whole runs of the same color go out at once
+    if(row->rwidth == rsize) {
+        int length = rsize - start;
+        if(length < 0) {
+            length = 0;
+        }
+        if(length > cols) {
+            length = cols;
+        }
+
+        int i = start;
+        while(i < start + length) {
+            int run = i + 1;
+            while(run < start + length && hl[run] == hl[i]) run++;
+            editorDrawColor(ab, hl[i], &current_color);
+            abAppend(ab, &c[i], run - i);
+            i = run;
+        }
+        editorDrawColorEnd(ab, current_color, tail && rsize >= start && rsize - start < cols);
+        return;
+    }
+
+    //otherwise walk the clusters to find the byte where column "start" is
+    int i = 0, col = 0, width = 0, len = 0;
+    while(i < rsize) {
+        len = utf8Cluster(&c[i], rsize - i, &width);
+        if(col + width > start) break;
+        col += width;
+        i += len;
+    }
+
+    //a wide character sticking out over the left edge
+    if(i < rsize && col < start) {
+        if(wrapped) {
+            editorDrawColor(ab, hl[i], &current_color);
+            abAppend(ab, &c[i], len);
+        }else {
+            abAppend(ab, " ", 1);
+        }
+        col += width;
+        i += len;
+    }
+
+    //clusters with the same color are collected into a run and appended together
+    int run = i;
+    while(i < rsize) {
+        if((unsigned char)c[i] < 0x80 && (i + 1 == rsize || (unsigned char)c[i + 1] < 0x80)) {
+            len = width = 1;        //an ASCII character with no combining marks after it
+        }else {
+            len = utf8Cluster(&c[i], rsize - i, &width);
+        }
+        if(col + width > start + cols) break;
+        if(hl[i] != hl[run]) {
+            editorDrawColor(ab, hl[run], &current_color);
+            abAppend(ab, &c[run], i - run);
+            run = i;
+        }
+        col += width;
+        i += len;
+    }
+    if(i > run) {
+        editorDrawColor(ab, hl[run], &current_color);
+        abAppend(ab, &c[run], i - run);
+    }
+
+    editorDrawColorEnd(ab, current_color, tail && i == rsize && col < start + cols);
+}
+
+// draws the line number for a row, or blanks for the rest of a wrapped row and past the end of the file
+void editorDrawGutter(struct abuf* ab, int filerow) {
+    int width = editorGutterWidth();
+    if(width == 0) return;
+
+    char buf[32];
+    int len;
+    if(filerow >= 0) {
+        len = snprintf(buf, sizeof(buf), "\x1b[38;5;240m%*d \x1b[39m", width - 1, filerow + 1);
+    }else {
+        len = snprintf(buf, sizeof(buf), "%*s", width, "");
+    }
+    abAppend(ab, buf, len);
+}
+
+// screen line the active pane starts on, the bottom pane starts below the top pane and its status bar
+int editorPaneTop() {
+    return (E.split && E.curBuffer == E.splitBottom) ? editorPaneRows(0) + 1 : 0;
+}
+
+// sends one finished line to screen line y, unless that's exactly what is there already
+void editorScreenLine(struct abuf* ab, int y, struct abuf* line) {
+    uint64_t h = UINT64_C(1469598103934665603);
+    for(int i = 0; i < line->length; i++) {
+        h = (h ^ (unsigned char)line->bufferString[i]) * UINT64_C(1099511628211);
+    }
+    h |= 1;                         //0 is kept for lines that aren't known
+
+    if(y < S.numLines) {
+        if(S.lines[y] == h) return;
+        S.lines[y] = h;
+    }
+    char buf[32];
+    int len = snprintf(buf, sizeof(buf), "\x1b[%d;1H", y + 1);
+    abAppend(ab, buf, len);
+    abAppend(ab, line->bufferString, line->length);
+}
+
+// if the pane still shows the same buffer and has only moved up or down a bit, the terminal scrolls what it
+// already has into place (inside a scroll region, so the other pane and the bars stay put) and the lines
+// that come into view are the only ones that get sent
+void editorScreenScroll(struct abuf* ab, int start) {
+    struct paneState* last = &S.pane[start > 0];
+    int top = E.wrap ? E.voff : E.rowoff;
+    int moved = top - last->top;
+    int lines = moved < 0 ? -moved : moved;
+
+    if(last->buffer == E.curBuffer && last->wrap == E.wrap && last->start == start && last->rows == E.rows &&
+            lines > 0 && lines < E.rows && start + E.rows <= S.numLines) {
+        char buf[48];
+        int len = snprintf(buf, sizeof(buf), "\x1b[%d;%dr\x1b[%d%c\x1b[r", start + 1, start + E.rows, lines, moved > 0 ? 'S' : 'T');
+        abAppend(ab, buf, len);
+
+        uint64_t* pane = &S.lines[start];
+        if(moved > 0) {
+            memmove(pane, pane + lines, sizeof(uint64_t) * (E.rows - lines));
+            memset(pane + E.rows - lines, 0, sizeof(uint64_t) * lines);
+        }else {
+            memmove(pane + lines, pane, sizeof(uint64_t) * (E.rows - lines));
+            memset(pane, 0, sizeof(uint64_t) * lines);
+        }
+    }
+
+    last->buffer = E.curBuffer;
+    last->wrap = E.wrap;
+    last->start = start;
+    last->rows = E.rows;
+    last->top = top;
+}
+
+// the hex view's lines: the offset, the bytes in two groups of eight, and the bytes as text like hexdump -C
+// edited bytes are colored like numbers, and the cursor's byte is also marked in the text column
+void editorDrawHexRows(struct abuf* ab) {
+    struct hexView* h = E.hex;
+    editorHexClamp();
+
+    int start = editorPaneTop();
+    editorScreenScroll(ab, start);
+
+    struct abuf line = ABUF_INIT;
+    long long cursor = editorHexOffset();
+    for(int i = 0; i < E.rows; i++) {
+        line.length = 0;
+        long long offset = (long long)(E.rowoff + i) * HEX_BYTES;
+        if(offset >= h->size) {
+            abAppend(&line, "~", 1);
+            abAppend(&line, "\x1b[K", 3);
+            editorScreenLine(ab, start + i, &line);
+            continue;
+        }
+        unsigned char bytes[HEX_BYTES];
+        int changed[HEX_BYTES];
+        int n = editorHexRead(offset, HEX_BYTES, bytes, changed);
+
+        //laid out first with a color for every column, then drawn in runs like a row is
+        char text[80];
+        unsigned char hl[80];
+        memset(text, ' ', sizeof(text));
+        memset(hl, HL_NORMAL, sizeof(hl));
+        for(int j = 0; j < n; j++) {
+            int col = 12 + 3 * j + (j >= HEX_BYTES / 2);
+            text[col] = "0123456789abcdef"[bytes[j] >> 4];
+            text[col + 1] = "0123456789abcdef"[bytes[j] & 0xf];
+            text[63 + j] = bytes[j] >= 0x20 && bytes[j] < 0x7f ? bytes[j] : '.';
+            if(changed[j]) hl[col] = hl[col + 1] = hl[63 + j] = HL_NUMBER;
+            if(offset + j == cursor) hl[63 + j] |= HL_SELECTED;
+        }
+        text[62] = '|';
+        text[63 + n] = '|';
+
+        char buf[32];
+        int len = snprintf(buf, sizeof(buf), "\x1b[38;5;240m%010llx\x1b[39m", offset);
+        abAppend(&line, buf, len);
+        int cols = E.cols < 64 + n ? E.cols : 64 + n;
+        int current_color = -1;
+        int j = 10;
+        while(j < cols) {
+            int run = j + 1;
+            while(run < cols && hl[run] == hl[j]) run++;
+            editorDrawColor(&line, hl[j], &current_color);
+            abAppend(&line, &text[j], run - j);
+            j = run;
+        }
+        editorDrawColorEnd(&line, current_color, 0);
+        abAppend(&line, "\x1b[K", 3);
+        editorScreenLine(ab, start + i, &line);
     }
+    abFree(&line);
 
+    char buf[32];
+    int len = snprintf(buf, sizeof(buf), "\x1b[%d;1H", start + E.rows + 1);
+    abAppend(ab, buf, len);
+    if(start + E.rows < S.numLines) S.lines[start + E.rows] = 0;
 }
 
 //draws a tilde on each line, and a welcome message
 void editorDrawRows(struct abuf* ab) {
+    if(E.hex) {
+        editorDrawHexRows(ab);
+        return;
+    }
+    int start = editorPaneTop();
+    editorScreenScroll(ab, start);
+
+    //every line is built on its own first, and only sent if it isn't on the screen already
+    struct abuf line = ABUF_INIT;
+
+    //when wrapping, find the row and segment at the top of the screen once and walk forward from there
+    int seg = 0;
+    int wraprow = E.wrap ? editorWrapFind(E.voff, &seg) : 0;
+
     int i;
     for(i = 0; i < E.rows; i++) {
+        line.length = 0;
         //displays a welcome message
-        int filerow = i + E.rowoff;
+        int filerow = E.wrap ? wraprow : i + E.rowoff;
         if(filerow >= E.numRows) {
             //this if statement ^^^ checks if anything has been written yet
             if(E.numRows == 0 && i == E.rows / 3) {
@@ -695,67 +4898,75 @@ void editorDrawRows(struct abuf* ab) {
                 int padding = (E.cols - welcomelen) / 2;
                 if(padding) {
                     //this statement just makes sure the first line has the tilde
-                    abAppend(ab, "~", 1);
+                    abAppend(&line, "~", 1);
                     padding--;
                 }
                 while(padding--) {
                     //this keep adding spaces until the padding is 0
-                    abAppend(ab, " ", 1);
+                    abAppend(&line, " ", 1);
                 }
 
-                abAppend(ab, welcome, welcomelen);
+                abAppend(&line, welcome, welcomelen);
             }else {
-                abAppend(ab, "~", 1);
+                editorDrawGutter(&line, -1);
+                abAppend(&line, "~", 1);
             }
-        } else {
+        } else if(E.wrap) {
             //in the case that there has already been something written already
-            int length = E.row[filerow].rsize - E.coloff;
-            if(length < 0) {
-                length = 0;
+            editorDrawGutter(&line, seg == 0 ? filerow : -1);
+            editorDrawRowSegment(&line, &E.row[filerow], seg * editorWrapWidth(), 1);
+            if(++seg >= E.row[filerow].vlines) {
+                seg = 0;
+                wraprow++;
             }
-            if(length > E.cols) {
-                length = E.cols;
-            }
-
-            // need to iterate through every character and if it is a digit, change color
-            char* c = &E.row[filerow].render[E.coloff];
-            unsigned char* hl = &E.row[filerow].hl[E.coloff];
-            int current_color = -1;
-            for(int i = 0; i < length; i++) {
-                if(hl[i] == HL_NORMAL) {
-                    if(current_color != -1) {
-                        abAppend(ab, "\x1b[39m", 5);    // set to the default color
-                        current_color = -1;
-                    }
-                    abAppend(ab, &c[i], 1);
-                }else {
-                    int color = editorSyntaxToColor(hl[i]);
-                    if(color != current_color) {
-                        current_color = color;
-                        char buf[16];
-                        int clen = snprintf(buf, sizeof(buf), "\x1b[38;5;%dm", color);
-                        abAppend(ab, buf, clen);
-                    }
-                    abAppend(ab, &c[i], 1);
-                }
-            }
-
-            abAppend(ab, "\x1b[39m", 5);
+        } else {
+            editorDrawGutter(&line, filerow);
+            editorDrawRowSegment(&line, &E.row[filerow], E.coloff, 0);
         }
 
         //this K command erases part of a line, its parameter is 0, so it will erase to right of the line
-        abAppend(ab, "\x1b[K", 3);
-
-        abAppend(ab, "\r\n", 2);
+        abAppend(&line, "\x1b[K", 3);
+        editorScreenLine(ab, start + i, &line);
     }
+    abFree(&line);
+
+    //the status bar goes right below, and whatever was on its line before is gone
+    char buf[32];
+    int len = snprintf(buf, sizeof(buf), "\x1b[%d;1H", start + E.rows + 1);
+    abAppend(ab, buf, len);
+    if(start + E.rows < S.numLines) S.lines[start + E.rows] = 0;
 }
 
 void editorDrawStatusBar(struct abuf* ab) {
     abAppend(ab, "\x1b[7m", 4);
     //stores the status bar stuff, rstatus is the current line number aligned to the right
-    char status[80], rstatus[80];
-    int len = snprintf(status, sizeof(status), "%.20s - %d lines %s", E.filename ? E.filename : "[No Name]", E.numRows, E.dirty ? "(modified)" : "");
-    int rlen = snprintf(rstatus, sizeof(rstatus), "File Type: %s | Cursor: %d | Rows: %d", E.syntax ? E.syntax->filetype : "none", E.cursorY + 1, E.numRows);
+    char status[80], rstatus[80], bufnum[32] = "";
+    if(E.numBuffers > 1) {
+        snprintf(bufnum, sizeof(bufnum), "[%d/%d] ", E.curBuffer + 1, E.numBuffers);
+    }
+    //once anything is packed, how well it packs and how long unpacking a block takes
+    char cold[32] = "";
+    if(CS.packedBytes > 0) {
+        snprintf(cold, sizeof(cold), " [lz %.1fx %.0fus]", (double)CS.rawBytes / CS.packedBytes, CS.unpackUs);
+    }
+    //how many of the rows that needed highlighting hadn't changed or were found in the memo
+    char memo[32] = "";
+    if(RM.refreshes > 0) {
+        snprintf(memo, sizeof(memo), " [memo %.0f%%]", 100.0 * (RM.skips + RM.hits) / RM.refreshes);
+    }
+    int len, rlen;
+    if(E.hex) {
+        len = snprintf(status, sizeof(status), "%s%.20s - %lld bytes%s%s", bufnum, E.filename, E.hex->size,
+            E.dirty ? " (modified)" : "", E.diskChanged ? " (changed on disk)" : "");
+        rlen = snprintf(rstatus, sizeof(rstatus), "File Type: binary | Offset: 0x%llx", editorHexOffset());
+    }else {
+        len = snprintf(status, sizeof(status), "%s%.20s - %d lines%s%s%s%s", bufnum, E.filename ? E.filename : "[No Name]", E.numRows,
+            E.dirty ? " (modified)" : "", E.diskChanged ? " (changed on disk)" : "", cold, memo);
+        rlen = snprintf(rstatus, sizeof(rstatus), "File Type: %s | Cursor: %d | Rows: %d", E.syntax ? E.syntax->filetype : "none", E.cursorY + 1, E.numRows);
+    }
+    if(len >= (int)sizeof(status)) {
+        len = sizeof(status) - 1;
+    }
     
     if(len > E.cols) {
         len = E.cols;
@@ -787,9 +4998,35 @@ void editorDrawMessageBar(struct abuf* ab) {
     }
 }
 
+// draws one pane of a split screen with its own status bar; an inactive buffer is
+// loaded into E just for the drawing and parked again afterwards
+void editorDrawPane(struct abuf* ab, int buffer) {
+    int active = E.curBuffer;
+    int rows = E.rows;
+
+    if(buffer != active) {
+        editorStashBuffer(&E.buffers[active]);
+        editorLoadBuffer(&E.buffers[buffer]);
+        E.curBuffer = buffer;
+        E.rows = editorPaneRows(buffer == E.splitBottom);
+    }
+
+    editorDrawRows(ab);
+    editorDrawStatusBar(ab);
+
+    if(buffer != active) {
+        editorStashBuffer(&E.buffers[buffer]);      //drawing may have rebuilt its caches
+        editorLoadBuffer(&E.buffers[active]);
+        E.curBuffer = active;
+        E.rows = rows;
+    }
+}
+
 //clears the screen
 void editorRefreshScreen() {
     editorScroll();
+    editorFindCursorMatch();
+    editorOutputReclaim();
 
     struct abuf ab = ABUF_INIT;
 
@@ -813,22 +5050,33 @@ void editorRefreshScreen() {
     there's no argument because the default is the row and column 1, 1 which is already at the top left
     */
 
-    editorDrawRows(&ab);
-    editorDrawStatusBar(&ab);
+    if(E.split) {
+        editorDrawPane(&ab, E.splitTop);
+        editorDrawPane(&ab, E.splitBottom);
+    }else {
+        editorDrawRows(&ab);
+        editorDrawStatusBar(&ab);
+    }
     editorDrawMessageBar(&ab);
 
     /*
     this places the cursor after the character that was entered
     add one because the terminal starts at 1, but indices still start at 0 in C
     */
+    int top = editorPaneTop();
+    int cy = E.cursorY - E.rowoff;
+    int cx = E.rx - E.coloff;
+    if(E.wrap && !E.hex) {
+        cy = editorWrapRowStart(E.cursorY) + E.rx / editorWrapWidth() - E.voff;
+        cx = E.rx % editorWrapWidth();
+    }
     char buf[32];
-    snprintf(buf, sizeof(buf), "\x1b[%d;%dH", (E.cursorY - E.rowoff) + 1, (E.rx - E.coloff) + 1);
+    snprintf(buf, sizeof(buf), "\x1b[%d;%dH", cy + top + 1, cx + editorGutterWidth() + 1);
     abAppend(&ab, buf, strlen(buf));
 
     abAppend(&ab, "\x1b[?25h", 6);
 
-    write(STDOUT_FILENO, ab.bufferString, ab.length);
-    abFree(&ab);
+    editorOutputFrame(&ab);
 }
 
 void editorSetStatusMessage(const char* fmt, ...) {
@@ -855,9 +5103,14 @@ char* editorPrompt(char* prompt) {
 
         int c = editorReadKey();
         if(c == DEL_KEY || c == CTRL_KEY('h') || c == BACKSPACE) {
+            //takes off a whole UTF-8 character, not just its last byte
+            while(buflen != 0 && ((unsigned char)buf[buflen - 1] & 0xC0) == 0x80) {
+                buflen--;
+            }
             if(buflen != 0) {
-                buf[--buflen] = '\0';
+                buflen--;
             }
+            buf[buflen] = '\0';
         }
         else if(c == '\x1b') {
             editorSetStatusMessage("");
@@ -869,7 +5122,7 @@ char* editorPrompt(char* prompt) {
                 editorSetStatusMessage("");
                 return buf;
             }
-        }else if(!iscntrl(c) && c < 128) {
+        }else if(c < 256 && (c >= 128 || !iscntrl(c))) {       //bytes from 128 up are part of UTF-8 characters
             if(buflen == bufsize - 1) {
                 bufsize *= 2;
                 buf = realloc(buf, bufsize);
@@ -880,6 +5133,13 @@ char* editorPrompt(char* prompt) {
     }
 }
 
+// after moving up or down, puts the cursor in the same screen column it had on the old row
+// so it doesn't land in the middle of a tab or a UTF-8 character
+void editorKeepColumn(erow* from) {
+    if(from == NULL || E.cursorY >= E.numRows) return;
+    E.cursorX = editorRowRxToCx(&E.row[E.cursorY], editorRowCursorXToRx(from, E.cursorX));
+}
+
 //lets the user move the cursor
 void editorMoveCursor(int key) {
     erow *row = (E.cursorY >= E.numRows) ? NULL: &E.row[E.cursorY];     //makes sure that cursorY is still in file
@@ -887,7 +5147,7 @@ void editorMoveCursor(int key) {
     switch(key){
         case ARROW_LEFT:
             if(E.cursorX != 0) {
-                E.cursorX--;
+                E.cursorX = editorRowPrevCluster(row, E.cursorX);
             }else if(E.cursorY > 0) {
                 E.cursorY--;
                 E.cursorX = E.row[E.cursorY].size;
@@ -896,7 +5156,7 @@ void editorMoveCursor(int key) {
         case ARROW_RIGHT:
             if(row && E.cursorX < row->size) {
                 //just checks that the x cursor is to the left
-                E.cursorX++;
+                E.cursorX = editorRowNextCluster(row, E.cursorX);
             }else if(row && E.cursorX == row->size) {
                 E.cursorY++;
                 E.cursorX = 0;
@@ -905,11 +5165,13 @@ void editorMoveCursor(int key) {
         case ARROW_UP:
             if(E.cursorY != 0) {
                 E.cursorY--;
+                editorKeepColumn(row);
             }
             break;
         case ARROW_DOWN:
             if(E.cursorY < E.numRows) {
                 E.cursorY++;
+                editorKeepColumn(row);
             }
             break;
     }
@@ -922,22 +5184,110 @@ void editorMoveCursor(int key) {
     }
 }
 
+// jumps straight to a line: the cursor and scroll offset are just set, no matter how far away it is,
+// and the target line ends up in the middle of the screen
+void editorGoToLine() {
+    char* input = editorPrompt("Go to line: %s (ESC to cancel)");
+    if(input == NULL) return;
+
+    char* end;
+    long line = strtol(input, &end, 10);
+    if(end == input || *end != '\0') {
+        editorSetStatusMessage("Not a line number: %s", input);
+        free(input);
+        return;
+    }
+    free(input);
+
+    if(line < 1) line = 1;
+    if(line > E.numRows) line = E.numRows;
+    if(E.numRows == 0) return;
+
+    E.cursorY = line - 1;
+    E.cursorX = 0;
+    E.coloff = 0;
+    if(E.wrap) {
+        E.voff = editorWrapRowStart(E.cursorY) - E.rows / 2;
+        if(E.voff < 0) E.voff = 0;
+    }else {
+        E.rowoff = E.cursorY - E.rows / 2;
+        if(E.rowoff < 0) E.rowoff = 0;
+    }
+}
+
+// moves the screen "lines" lines down (up if negative) and takes the cursor along, so it stays on the same
+// screen line and column; both are worked out directly, paging through a huge file costs the same as one line
+void editorScrollLines(int lines) {
+    int rx = E.cursorY < E.numRows ? editorRowCursorXToRx(&E.row[E.cursorY], E.cursorX) : 0;
+
+    if(E.wrap) {
+        int width = editorWrapWidth();
+        int total = editorWrapRowStart(E.numRows);
+        int cv = editorWrapRowStart(E.cursorY) + rx / width;
+
+        //paging stops once the end of the file reaches the bottom of the screen
+        int last = total + 1 - E.rows > E.voff ? total + 1 - E.rows : E.voff;
+        E.voff += lines;
+        if(E.voff > last) E.voff = last;
+        if(E.voff < 0) E.voff = 0;
+
+        cv += lines;
+        if(cv > total) cv = total;
+        if(cv < 0) cv = 0;
+        int seg;
+        E.cursorY = editorWrapFind(cv, &seg);
+        rx = seg * width + rx % width;
+    }else {
+        int last = E.numRows + 1 - E.rows > E.rowoff ? E.numRows + 1 - E.rows : E.rowoff;
+        E.rowoff += lines;
+        if(E.rowoff > last) E.rowoff = last;
+        if(E.rowoff < 0) E.rowoff = 0;
+
+        E.cursorY += lines;
+        if(E.cursorY > E.numRows) E.cursorY = E.numRows;
+        if(E.cursorY < 0) E.cursorY = 0;
+    }
+
+    E.cursorX = E.cursorY < E.numRows ? editorRowRxToCx(&E.row[E.cursorY], rx) : 0;
+}
+
+// whether there are more keys waiting to be read
+int editorInputPending() {
+    int n = 0;
+    return ioctl(STDIN_FILENO, FIONREAD, &n) == 0 && n > 0;
+}
+
 //processes the input, maps keys to different functions
 void editorProcessKeypress() {
     static int quit_times = HEAT_QUIT_TIMES;
+    static int reload_asked = 0;
 
     int c = editorReadKey();
 
+    //with extra cursors or a block, edits go to all of them at once
+    if((E.numCursors > 0 || E.block) && editorMultiKey(c)) {
+        quit_times = HEAT_QUIT_TIMES;
+        reload_asked = 0;
+        return;
+    }
+    //a hex buffer has its own editing and moving around
+    if(E.hex && editorHexKey(c)) {
+        quit_times = HEAT_QUIT_TIMES;
+        reload_asked = 0;
+        return;
+    }
+
     switch(c) {
         case '\r':
             editorInsertNewline();
             break;
         case CTRL_KEY('z'):
-            if(E.dirty && quit_times > 0) {
-                editorSetStatusMessage("Warning. File has unsaved changes. Press Ctrl-Z %d more times to quit.", quit_times);
+            if(editorDirtyBuffers() && quit_times > 0) {
+                editorSetStatusMessage("Warning. %d buffer(s) have unsaved changes. Press Ctrl-Z %d more times to quit.", editorDirtyBuffers(), quit_times);
                 quit_times--;
                 return;
             }
+            editorOutputFlush();
             write(STDOUT_FILENO, "\x1b[2J", 4);
             write(STDOUT_FILENO, "\x1b[H", 3);
             exit(0);
@@ -945,6 +5295,54 @@ void editorProcessKeypress() {
         case CTRL_KEY('s'):
             editorSave();
             break;
+        case CTRL_KEY('o'):
+            editorOpenBuffer();
+            break;
+        case CTRL_KEY('b'):
+            editorNextBuffer();
+            break;
+        case CTRL_KEY('w'):
+            editorToggleSplit();
+            break;
+        case CTRL_KEY('e'):
+            editorToggleWrap();
+            break;
+        case CTRL_KEY('n'):
+            E.gutter = !E.gutter;
+            break;
+        case CTRL_KEY('g'):
+            editorGoToLine();
+            break;
+        case CTRL_KEY('a'):
+            editorAddCursorBelow();
+            break;
+        case CTRL_KEY('q'):
+            editorToggleBlock();
+            break;
+        case CTRL_KEY('k'):
+            E.mark = !E.mark;
+            E.markY = E.cursorY;
+            break;
+        case CTRL_KEY('c'):
+            editorCopy();
+            break;
+        case CTRL_KEY('x'):
+            editorCut();
+            break;
+        case CTRL_KEY('v'):
+            editorPaste();
+            break;
+        case CTRL_KEY(']'):
+            editorJumpBracket();
+            break;
+        case CTRL_KEY('r'):
+            if(E.dirty && !reload_asked) {
+                editorSetStatusMessage("Unsaved changes will be lost, press Ctrl-R again to reload");
+                reload_asked = 1;
+                return;
+            }
+            editorReload();
+            break;
         case HOME_KEY:
             E.cursorX = 0;
             break;
@@ -963,38 +5361,37 @@ void editorProcessKeypress() {
             editorDelChar();
             break;
         case PAGE_UP: case PAGE_DOWN:
-            {
-                if(c == PAGE_UP) {
-                    E.cursorY = E.rowoff;
-                } else if(c == PAGE_DOWN) {
-                    E.cursorY = E.rowoff + E.rows - 1;
-                    if(E.cursorY > E.numRows) {
-                        E.cursorY = E.numRows;
-                    }
-                }
-                //times can't be declared in the case, so must make it a block using brackets
-                int times = E.rows;
-                while(times--) {
-                    //ternary operator
-                    editorMoveCursor(c == PAGE_UP ? ARROW_UP : ARROW_DOWN);
-                }
-            }
+            editorScrollLines(c == PAGE_UP ? -E.rows : E.rows);
+            break;
+        case CTRL_KEY('u'): case CTRL_KEY('d'):
+            //half a page, like vi
+            editorScrollLines((c == CTRL_KEY('u') ? -1 : 1) * (E.rows / 2 > 0 ? E.rows / 2 : 1));
             break;
         case ARROW_LEFT: case ARROW_RIGHT: case ARROW_UP: case ARROW_DOWN:
             editorMoveCursor(c);
             break;
 
         case CTRL_KEY('l'):
+            // refresh, don't do anything
+            break;
         case '\x1b':
-            // refresh/escape, don't do anything
+            E.mark = 0;
             break;
 
         default:
             editorInsertChar(c);
+            //the rest of a UTF-8 character is already waiting, so it goes in before the next redraw
+            if(c >= 0xC2 && c <= 0xF4) {
+                int more = c >= 0xF0 ? 3 : c >= 0xE0 ? 2 : 1;
+                while(more--) {
+                    editorInsertChar(editorReadKey());
+                }
+            }
             break;
     }
 
     quit_times = HEAT_QUIT_TIMES;
+    reload_asked = 0;
 }
 
 /*--------------------------------------------------INITIALIZATION----------------------------------------------*/
@@ -1012,23 +5409,67 @@ void initEditor() {
     E.filename = NULL;
     E.statusmsg[0] = '\0';
     E.statusmsg_time = 0;
-    if(getWindowSize(&E.rows, &E.cols) == -1) die("getWindowSize");
-    E.rows -= 2;
     E.syntax = NULL;
+
+    //starts out with one empty buffer, which is what E holds right now
+    E.buffers = malloc(sizeof(struct editorBuffer));
+    E.numBuffers = 1;
+    E.curBuffer = 0;
+    E.split = 0;
+    E.wrap = 0;
+    E.voff = 0;
+    E.wraptree = NULL;
+    E.wrapRows = E.wrapWidth = 0;
+    E.wrapSize = 0;
+    E.wrapStale = 1;
+    E.gutter = 0;
+    E.cursors = NULL;
+    E.numCursors = 0;
+    E.block = 0;
+    E.mark = 0;
+    E.brackettree = NULL;
+    E.bracketRows = 0;
+    E.bracketSize = 0;
+    E.bracketStale = 1;
+    E.inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    E.watch = 0;
+    E.diskChanged = 0;
+    E.hex = NULL;
+    editorStashBuffer(&E.buffers[0]);
+
+    int rows, cols;
+    if(getWindowSize(&rows, &cols) == -1) die("getWindowSize");
+    editorSetScreenSize(rows, cols);
+    editorWatchResize();
 }
 
 int main(int argc, char* argv[]) {
+    char syntaxError[256] = "";
+    int brokenSyntax = editorLoadSyntaxes(syntaxError, sizeof(syntaxError));
+
     enableRawMode();
     initEditor();
-    if(argc >= 2) {
-        editorOpen(argv[1]);
+    editorStartWriter();
+    //every file on the command line gets its own buffer, the first one is shown
+    for(int i = 1; i < argc; i++) {
+        if(i > 1) editorNewBuffer();
+        if(editorOpen(argv[i]) == -1) die("fopen");
     }
+    editorSwitchBuffer(0);
     
-    editorSetStatusMessage("HELP: Ctrl-Z = quit");
+    editorSetStatusMessage("HELP: ^S save | ^O open | ^B buffer | ^W split | ^E wrap | ^N numbers | ^G go to | ^Z quit");
+    if(brokenSyntax) {
+        editorSetStatusMessage("Skipped %d syntax file(s), %s", brokenSyntax, syntaxError);
+    }
     
     while(1) {
         editorRefreshScreen();
-        editorProcessKeypress();
+        //everything that's already been typed is handled before drawing again, so a held down page key on a
+        //slow link makes one jump and one redraw instead of a redraw per key
+        double start = editorNowUs();
+        do {
+            editorProcessKeypress();
+        }while(editorInputPending() && editorNowUs() - start < HEAT_COALESCE_MS * 1000);
     }
 
     return 5;